@@ -30,30 +30,245 @@
 // Don't modify any of this file unless you really understand what you are doing
 // Includes
 // ========
-#include "KMulti.h"
+#include "kmulti.h"
 #include "kdos.h"
 #include "k_hal.h"
 #include <stdlib.h>
 #include <stdbool.h>
+#if BYTE_STREAMS
+#include <string.h>
+#endif
 
 // Macros and enumerations
 // =======================
 
+// Kernel critical sections. On a single core every lock below is interrupt
+// masking. With SMP_CORES > 1 each core's ring (and the tasks on it: queues,
+// timers, flags) has its own spinlock, and KernelLock covers what the cores share:
+// the task pool, topics, streams and the clock. Locks are taken kernel first, then
+// cores in index order; OverrunLock is innermost. The outermost lock masks the
+// core's interrupts, nested ones (and those taken by the tick ISR) only spin.
+#if SMP_CORES > 1
+#define LOCK(Lock)       do { K_HAL_DisableInterrupts(); K_HAL_SpinLock(Lock); } while (0)
+#define UNLOCK(Lock)     do { K_HAL_SpinUnlock(Lock); K_HAL_EnableInterrupts(); } while (0)
+#define NEST(Lock)       K_HAL_SpinLock(Lock)
+#define UNNEST(Lock)     K_HAL_SpinUnlock(Lock)
+#define CURRENT_CORE()   (&Cores[K_HAL_CoreID()])
+#define LOCK_TASK(Task)  (K_HAL_DisableInterrupts(), NestTask(Task))
+#define NEST_TASK(Task)  NestTask(Task)
+#else
+#define LOCK(Lock)       K_HAL_DisableInterrupts()
+#define UNLOCK(Lock)     K_HAL_EnableInterrupts()
+#define NEST(Lock)
+#define UNNEST(Lock)
+#define CURRENT_CORE()   (&Cores[0])
+#define LOCK_TASK(Task)  (K_HAL_DisableInterrupts(), &Cores[0])
+#define NEST_TASK(Task)  (&Cores[0])
+#endif
+#define ENTER_CRITICAL() LOCK(&KernelLock)
+#define EXIT_CRITICAL()  UNLOCK(&KernelLock)
+#if SMP_CORES > 1
+#define LOCK_CORE(C)     LOCK(&(C)->Lock)
+#define UNLOCK_CORE(C)   UNLOCK(&(C)->Lock)
+#define NEST_CORE(C)     NEST(&(C)->Lock)
+#define UNNEST_CORE(C)   UNNEST(&(C)->Lock)
+#else
+#define LOCK_CORE(C)     ((void)(C), K_HAL_DisableInterrupts())
+#define UNLOCK_CORE(C)   ((void)(C), K_HAL_EnableInterrupts())
+#define NEST_CORE(C)     ((void)(C))
+#define UNNEST_CORE(C)   ((void)(C))
+#endif
+
+// Per-core scheduler state, under the names the rest of this file has always used.
+// Functions using them start with Self = CURRENT_CORE(), so the core is looked up
+// once per call rather than on every access.
+#define TaskCurrent           (Self->Current)
+#define MultiTask             (Self->Multi)
+#define OS_SP                 (Self->SP)
+#define g_LastTaskReturnValue (Self->ReturnValue)
+#define TaskReturned          (Self->Returned)
+#define TaskExiting           (Self->Exiting)
+#define DispatchMsg           (Self->Msg)
+#define TaskCount             (Self->Count)
+#define DispatchStart         (Self->Start)
+#define TaskRunning           (Self->Running)
+#define BudgetHookFired       (Self->HookFired)
+
+// Ring links. With COMPACT_TCB they are indexes into TaskTable; the free lists
+// of deleted tasks can end, which an index spells TASK_NONE.
+#if COMPACT_TCB
+#define TASK_NONE                 0xff
+#define NEXT_TASK(Task)           (&TaskTable[(Task)->TaskNext])
+#define SET_NEXT_TASK(Task, Next) ((Task)->TaskNext = (BYTE)((Next) - TaskTable))
+#define NEXT_FREE(Task)           ((Task)->TaskNext == TASK_NONE ? NULL : &TaskTable[(Task)->TaskNext])
+#define SET_NEXT_FREE(Task, Next) ((Task)->TaskNext = (Next) ? (BYTE)((Next) - TaskTable) : TASK_NONE)
+#else
+#define NEXT_TASK(Task)           ((Task)->TaskNext)
+#define SET_NEXT_TASK(Task, Next) ((Task)->TaskNext = (Next))
+#define NEXT_FREE(Task)           NEXT_TASK(Task)
+#define SET_NEXT_FREE(Task, Next) SET_NEXT_TASK(Task, Next)
+#endif
+
+// How the tick handler is declared. Only ARM GCC knows interrupt("IRQ"); other
+// targets (the host build, AVR where it would return with reti) call the handler
+// from their own vector as a plain function. A BSP may override this.
+#ifndef K_HAL_ISR_FUNCTION_ATTRIBUTE
+#if defined(__arm__)
+#define K_HAL_ISR_FUNCTION_ATTRIBUTE __attribute__((interrupt("IRQ")))
+#else
+#define K_HAL_ISR_FUNCTION_ATTRIBUTE
+#endif
+#endif
+
 // Prototypes
 // ==========
-void key_timer_irq_handler(void) __attribute__((interrupt("IRQ")));
+struct CORE;
+void K_HAL_ISR_FUNCTION_ATTRIBUTE key_timer_irq_handler(void);
 static void SwitchTask(void);
 // Changed prototype for DefaultTaskExitHandler
 static void DefaultTaskExitHandler(WORD task_return_value);
+#if TASK_BUDGETS
+static void CheckBudget(struct CORE *Self);
+#endif
+static struct TASK *AllocTask(INT StackSize, INT QueueSize);
+static void AdvanceTime(WORD Ticks);
+static void ReapTask(struct TASK *Task);
+static void ReapCurrent(struct CORE *Self);
+static void LinkTask(struct TASK *Task, BYTE Core);
+static void UnlinkTask(struct TASK *Task);
+static bool TaskReady(struct TASK *Task);
+static void ResetQueue(struct TASK *Task);
+static void GetMsg(struct TASK *Task, struct MSG *Msg);
+static struct MSG *PeekMsg(struct TASK *Task);
+#if EDF_SCHED
+static bool PutMsgDeadline(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam, LONG Deadline);
+// Messages sent without a deadline are due the receiver's relative deadline later
+#define PutMsg(Task, MsgType, sParam, lParam) \
+  PutMsgDeadline((Task), (MsgType), (sParam), (lParam), TickCount + (Task)->RelDeadline)
+static void EdfUpdate(struct TASK *Task);
+static void ReleaseTask(struct TASK *Task, LONG When);
+static bool MsgFirst(struct TASK *Task);
+#else
+static bool PutMsg(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam);
+#endif
+#if SMP_CORES > 1
+static WORD TaskEntry(WORD MsgType, WORD sParam, LONG lParam);
+static struct CORE *NestTask(struct TASK *Task);
+static void LockCores(struct CORE *A, struct CORE *B);
+static void UnlockCores(struct CORE *A, struct CORE *B);
+static void MoveTask(struct TASK *Task, BYTE Core, struct CORE *Self);
+static bool StealTask(struct CORE *Self);
+#endif
+#if MSG_TOPICS
+static void RemoveSubscriber(struct TOPIC *Topic, struct TASK *Task);
+#endif
+#if BYTE_STREAMS
+static void StreamTick(void);
+static bool StreamIdling(struct STREAM *Stream);
+#endif
+#if KDOS_CONSOLE
+static WORD ConsoleTask(WORD MsgType, WORD sParam, LONG lParam);
+#endif
 
 // Module variables
 // ================
 
-static struct TASK *TaskCurrent = NULL;
-static bool MultiTask = TRUE;
-static int32_t *OS_SP = NULL; // System Stack Pointer (used by K_HAL_ContextSwitch)
-static int32_t *OS_LP;
-static WORD g_LastTaskReturnValue; // Stores return value of task func across context switch
+// Each core runs its own SwitchTask over its own ring of tasks. Cores write their
+// own entry on every dispatch, so on SMP builds each one gets its own cache line.
+#if SMP_CORES > 1
+#define CORE_ALIGNED __attribute__((aligned(64)))
+#else
+#define CORE_ALIGNED
+#endif
+struct CORE
+{
+#if SMP_CORES > 1
+  volatile INT Lock;      // Guards the ring and its tasks
+#endif
+  struct TASK *Current;   // TaskCurrent: last task dispatched, anchors the ring (NULL = empty)
+  bool Multi;             // MultiTask: FALSE while a task sleeps with TASK_SWITCH_INHIBIT
+  void *SP;               // OS_SP: scheduler stack pointer (used by K_HAL_ContextSwitch)
+  WORD ReturnValue;       // Return value of the task func across the context switch
+  bool Returned;          // Last dispatch ended with the task function returning
+  bool Exiting;           // TaskCurrent called TaskExit() and must be reaped
+  struct MSG Msg;         // Message TaskCurrent was dispatched with
+  int Count;              // Tasks in the ring
+#if TASK_BUDGETS || SIM_TIME
+  volatile LONG Start;    // TickCount when TaskCurrent was dispatched
+#endif
+#if TASK_BUDGETS
+  struct TASK *volatile Running; // Task holding the CPU, NULL while in SwitchTask
+  volatile bool HookFired;       // Budget hook already called for this dispatch
+#endif
+#if KDOS_CONSOLE
+  WORD Generation;        // Bumped by every LinkTask/UnlinkTask on this ring
+  LONG Dispatches;
+#endif
+} CORE_ALIGNED;
+
+static struct CORE Cores[SMP_CORES];
+static bool OSRunning = FALSE;     // Set once SwitchTask owns TaskCurrent
+static volatile LONG TickCount;    // Ticks since the system timer was started
+#if SMP_CORES > 1
+static volatile INT KernelLock;
+static BYTE NextCore = 0;          // Where InitTask puts tasks created before RunOS
+#if TASK_BUDGETS
+static volatile INT OverrunLock;   // LastOverrun, written from any core's scheduler
+#endif
+#endif
+
+#if MSG_TOPICS
+static struct TOPIC *TopicList = NULL; // Every topic, so DeleteTask can unsubscribe
+#endif
+
+#if BYTE_STREAMS
+static struct STREAM *StreamList = NULL; // Every stream, for the idle timeout tick
+#endif
+
+#if KDOS_CONSOLE
+static void (*ConsolePut)(BYTE Byte);
+static struct STREAM *ConsoleIn;
+static char ConsoleLine[16];
+static BYTE ConsoleLen;
+#endif
+
+#if SIM_TIME
+static LONG SimStopAt;             // SimRun() returns once TickCount reaches this
+static LONG SimDispatchCount;
+static struct SIM_EVENT SimEvents[SIM_TIMELINE_SIZE];
+#endif
+
+#if EDF_SCHED
+// Every task TaskReady() accepts, as a binary min-heap on Task->Deadline
+static struct TASK *ReadyHeap[MAX_TASKS];
+static BYTE ReadyCount;
+#define HEAP_NONE 0xff
+// Deadline a falls before deadline b, correct across LONG wrap-around
+#define DEADLINE_BEFORE(a, b) ((LONG)((unsigned long)(a) - (unsigned long)(b)) < 0)
+#endif
+
+#if TASK_BUDGETS
+static void (*BudgetHook)(struct TASK *Task, WORD Ticks);
+static struct OVERRUN LastOverrun;
+static bool OverrunSeen;
+#endif
+
+// Deleted tasks keep their stack and queue and wait here, linked through TaskNext,
+// for an InitTask asking for the same sizes. The number of size classes is fixed so
+// both InitTask and DeleteTask find their class in bounded time.
+struct TASK_POOL
+{
+  INT StackSize;
+  INT QueueSize;
+  struct TASK *Free;
+};
+static struct TASK_POOL TaskPool[TASK_POOL_CLASSES];
+
+#if COMPACT_TCB
+static struct TASK TaskTable[MAX_TASKS];
+static BYTE TaskTableUsed;             // Entries handed out at least once
+static struct TASK *TaskTableFree;     // Entries whose memory went back to the heap
+#endif
 
 // Program
 // =======
@@ -61,6 +276,8 @@ static WORD g_LastTaskReturnValue; // Stores return value of task func across co
 // MODIFIED DefaultTaskExitHandler
 static void DefaultTaskExitHandler(WORD task_return_value)
 {
+  struct CORE *Self = CURRENT_CORE();
+
 #if DEBUG
   if (TaskCurrent)
   {
@@ -71,7 +288,9 @@ static void DefaultTaskExitHandler(WORD task_return_value)
     DebugPrintf("Unknown task exited.\n");
   }
 #endif
+  LOCK_CORE(Self); // K_HAL_ContextSwitch must be called inside the critical section
   g_LastTaskReturnValue = task_return_value;
+  TaskReturned = TRUE;
 
   // This task's timeslice is over, or it explicitly exited.
   // Switch back to the OS scheduler context.
@@ -90,26 +309,29 @@ struct TASK *InitTask(WORD (*Func)(WORD MsgType, WORD sParam, LONG lParam),
                       INT QueueSize,
                       BYTE TaskIDVal)
 {
+  struct CORE *Self = CURRENT_CORE();
   struct TASK *Task;
-  int32_t *Stack;
+#if EDF_SCHED
+  bool Full;
+#endif
 #if DEBUG_STATS == 1
   int t;
 #endif
 
-  Task = (struct TASK *)malloc(sizeof(struct TASK));
-  if (Task == NULL) { Emergency("T Failed"); }
-
-  Stack = (int32_t *)calloc(StackSize, sizeof(int32_t));
-  if (Stack == NULL) { Emergency("S Failed"); }
+#if EDF_SCHED
+  // Every task on the ring can be ready at once, and the ready heap has MAX_TASKS slots
+  ENTER_CRITICAL();
+  Full = (TaskCount >= MAX_TASKS);
+  EXIT_CRITICAL();
+  if (Full) { return NULL; }
+#endif
 
-  Task->MsgQueue = (struct MSG *)calloc(QueueSize, sizeof(struct MSG));
-  if (Task->MsgQueue == NULL) { Emergency("Q Failed"); }
+  Task = AllocTask(StackSize, QueueSize);
 
   Task->Func = Func;
   Task->TaskID = TaskIDVal;
-  Task->QueueCapacity = QueueSize;
 
-  Task->StackPtr = K_HAL_InitTaskStack(Stack,
+  Task->StackPtr = K_HAL_InitTaskStack(Task->StackBase,
                                        StackSize * sizeof(int32_t),
                                        Func,
                                        DefaultTaskExitHandler, // Now expects WORD param
@@ -118,194 +340,1676 @@ struct TASK *InitTask(WORD (*Func)(WORD MsgType, WORD sParam, LONG lParam),
                                        (LONG)0L);
   if (Task->StackPtr == NULL) { Emergency("StackInit Failed"); }
 
-  Task->MsgQueueIn = Task->MsgQueue;
-  Task->MsgQueueOut = Task->MsgQueue;
-  Task->MsgQueueEnd = Task->MsgQueue + QueueSize;
+  ResetQueue(Task);
   Task->Timer = 0;
   Task->TimerFlag = FALSE;
   Task->Sleeping = FALSE;
-  Task->MsgCount = 0;
+#if TASK_BUDGETS
+  Task->Budget = 0;
+  Task->OverrunCount = 0;
+#endif
+#if EDF_SCHED
+  Task->RelDeadline = EDF_DEFAULT_DEADLINE;
+  Task->Period = 0;
+  Task->DeadlineMisses = 0;
+  Task->HeapIndex = HEAP_NONE;
+#endif
+
+#if SMP_CORES > 1
+  Task->Affinity = TASK_ANY_CORE;
+  Task->Doomed = FALSE;
+#endif
 
-  if (TaskCurrent == NULL) { Task->TaskNext = Task; }
-  else {
-    Task->TaskNext = TaskCurrent->TaskNext;
-    TaskCurrent->TaskNext = Task;
+  ENTER_CRITICAL();
+#if SMP_CORES > 1
+  // Spread the initial task set over the cores; later tasks start on their creator's core
+  if (!OSRunning) {
+    Self = &Cores[NextCore];
+    NextCore = (BYTE)((NextCore + 1) % SMP_CORES);
   }
-  TaskCurrent = Task;
+#endif
+  NEST_CORE(Self);
+  LinkTask(Task, (BYTE)(Self - Cores));
+  // Once the scheduler is running TaskCurrent is the task calling us; the new
+  // task simply gets its turn after it.
+  if (!OSRunning) { TaskCurrent = Task; }
+  UNNEST_CORE(Self);
+  EXIT_CRITICAL();
   return Task;
 }
 
-void RunOS(void)
+// Inserts Task after the core's current task. The core's lock must be held.
+static void LinkTask(struct TASK *Task, BYTE Core)
 {
-  if (TaskCurrent == NULL) {
-    Emergency("RunOS: No tasks initialized prior to starting OS!");
-    while(1);
+  struct CORE *C = &Cores[Core];
+
+  if (C->Current == NULL) {
+    SET_NEXT_TASK(Task, Task);
+    C->Current = Task;
+  } else {
+    SET_NEXT_TASK(Task, NEXT_TASK(C->Current));
+    SET_NEXT_TASK(C->Current, Task);
   }
-  K_HAL_InitSystemTimer(key_timer_irq_handler);
-  K_HAL_StartScheduler(TaskCurrent->StackPtr);
-  Emergency("RunOS: K_HAL_StartScheduler returned unexpectedly!");
-  while(1);
+  ++C->Count;
+#if KDOS_CONSOLE
+  ++C->Generation;
+#endif
+#if SMP_CORES > 1
+  Task->Core = Core;
+#else
+  (void)Core;
+#endif
 }
 
-bool SendMsg(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam)
+// Removes Task from its core's ring. The core's lock must be held, and Task must
+// not be the context that is executing.
+static void UnlinkTask(struct TASK *Task)
 {
-  struct MSG *Msg;
-  if (Task) {
-    if (Task->MsgCount >= Task->QueueCapacity) { return false; }
-    K_HAL_DisableInterrupts();
-    Msg = Task->MsgQueueIn;
-    Msg->MsgType = MsgType;
-    Msg->sParam = sParam;
-    Msg->lParam = lParam;
-    if (++Task->MsgQueueIn >= Task->MsgQueueEnd) { Task->MsgQueueIn = Task->MsgQueue; }
-    ++Task->MsgCount;
-    K_HAL_EnableInterrupts();
-    return true;
+#if SMP_CORES > 1
+  struct CORE *C = &Cores[Task->Core];
+#else
+  struct CORE *C = &Cores[0];
+#endif
+  struct TASK *Prev;
+
+  --C->Count;
+#if KDOS_CONSOLE
+  ++C->Generation;
+#endif
+  if (NEXT_TASK(Task) == Task) {
+    C->Current = NULL;
+    return;
+  }
+  for (Prev = Task; NEXT_TASK(Prev) != Task; Prev = NEXT_TASK(Prev)) {}
+  SET_NEXT_TASK(Prev, NEXT_TASK(Task));
+  if (C->Current == Task) {
+    // The next SwitchTask round moves on to the task that followed this one
+    C->Current = Prev;
+    C->Multi = TRUE;
   }
-  return false;
 }
 
-void WakeUp(struct TASK *Task, INT WakeUpType)
+static struct TASK *AllocTask(INT StackSize, INT QueueSize)
 {
-  if (Task) {
-    K_HAL_DisableInterrupts();
-    if ((Task->Sleeping) && (!Task->TimerFlag)) {
-      Task->TimerFlag = TRUE;
-      Task->WakeUpType = WakeUpType;
+  struct TASK *Task;
+  int i;
+
+  ENTER_CRITICAL();
+  for (i = 0; i < TASK_POOL_CLASSES; i++) {
+    Task = TaskPool[i].Free;
+    if (Task && TaskPool[i].StackSize == StackSize && TaskPool[i].QueueSize == QueueSize) {
+      TaskPool[i].Free = NEXT_FREE(Task);
+      EXIT_CRITICAL();
+      return Task;
     }
-    K_HAL_EnableInterrupts();
   }
+#if COMPACT_TCB
+  if (QueueSize > 0xff) { Emergency("Q Failed"); }
+  Task = TaskTableFree;
+  if (Task) {
+    TaskTableFree = NEXT_FREE(Task);
+  } else if (TaskTableUsed < MAX_TASKS) {
+    Task = &TaskTable[TaskTableUsed++];
+  } else {
+    Emergency("T Failed");
+  }
+  EXIT_CRITICAL();
+#else
+  EXIT_CRITICAL();
+
+  Task = (struct TASK *)malloc(sizeof(struct TASK));
+  if (Task == NULL) { Emergency("T Failed"); }
+#endif
+
+  Task->StackBase = (int32_t *)calloc(StackSize, sizeof(int32_t));
+  if (Task->StackBase == NULL) { Emergency("S Failed"); }
+
+  Task->MsgQueue = (struct MSG *)calloc(QueueSize, sizeof(struct MSG));
+  if (Task->MsgQueue == NULL) { Emergency("Q Failed"); }
+
+  Task->StackSize = StackSize;
+  Task->QueueCapacity = QueueSize;
+  return Task;
 }
 
-// MODIFIED SwitchTask function (Phase 3: K_HAL_ContextSwitch integration)
-static void SwitchTask()
+// Unlinks Task from the ring and parks its memory in TaskPool. Must be called with
+// the kernel lock and the lock of Task's core held, and Task must not be the
+// context that is executing.
+static void ReapTask(struct TASK *Task)
 {
-  // static struct MSG *Msg; // Msg is no longer passed to Task->Func by SwitchTask
-  static WORD Delay;     // Will be set by g_LastTaskReturnValue
+  int i;
+#if MSG_TOPICS
+  struct TOPIC *Topic;
+#endif
+#if BYTE_STREAMS
+  struct STREAM *Stream;
+#endif
 
-  // OS_SP is now a global static. SwitchTask runs on this OS_SP.
-  // K_HAL_StartScheduler would have set OS_SP to the initial system SP.
+#if SMP_CORES == 1
+  // Other cores can keep an empty ring and steal work; a single core cannot
+  if (NEXT_TASK(Task) == Task) { Emergency("Last task deleted"); }
+#endif
+  UnlinkTask(Task);
 
-  while (TRUE)
-  {
-    K_HAL_DisableInterrupts();
-    if (MultiTask)
-    {
-      TaskCurrent = TaskCurrent->TaskNext;
+#if MSG_TOPICS
+  for (Topic = TopicList; Topic; Topic = Topic->TopicNext) { RemoveSubscriber(Topic, Task); }
+#endif
+#if BYTE_STREAMS
+  for (Stream = StreamList; Stream; Stream = Stream->StreamNext) {
+    if (Stream->Reader == Task) { Stream->Reader = NULL; }
+  }
+#endif
+
+  // Pending messages and timers die with the task
+#if SMP_CORES > 1
+  Task->Doomed = FALSE;
+#endif
+  ResetQueue(Task);
+  Task->Timer = 0;
+  Task->TimerFlag = FALSE;
+  Task->Sleeping = FALSE;
+#if EDF_SCHED
+  Task->Period = 0;
+  EdfUpdate(Task); // No longer ready: leaves the heap
+#endif
+
+  for (i = 0; i < TASK_POOL_CLASSES; i++) {
+    if (TaskPool[i].Free == NULL ||
+        (TaskPool[i].StackSize == Task->StackSize && TaskPool[i].QueueSize == Task->QueueCapacity)) {
+      TaskPool[i].StackSize = Task->StackSize;
+      TaskPool[i].QueueSize = Task->QueueCapacity;
+      SET_NEXT_FREE(Task, TaskPool[i].Free);
+      TaskPool[i].Free = Task;
+      return;
     }
+  }
+  // Every class is holding other sizes: give the memory back to the heap
+  free(Task->MsgQueue);
+  free(Task->StackBase);
+#if COMPACT_TCB
+  SET_NEXT_FREE(Task, TaskTableFree);
+  TaskTableFree = Task;
+#else
+  free(Task);
+#endif
+}
 
-    if (TaskCurrent->Sleeping)
-    {
-      if (TaskCurrent->TimerFlag) // Timer expired for sleeping task
-      {
-        TaskCurrent->Timer = 0;
-        TaskCurrent->TimerFlag = FALSE;
-        TaskCurrent->Sleeping = FALSE;
-        // Task is now ready to run. SwitchTask loop will continue,
-        // and this task (now not sleeping) will be dispatched below.
-        // No 'return' here anymore.
+// Reaps the core's current task from its scheduler, once the task is off the CPU.
+// The core's lock must not be held: the kernel lock comes first.
+static void ReapCurrent(struct CORE *Self)
+{
+  ENTER_CRITICAL();
+  NEST_CORE(Self);
+  ReapTask(TaskCurrent);
+  UNNEST_CORE(Self);
+  EXIT_CRITICAL();
+}
+
+void DeleteTask(struct TASK *Task)
+{
+  struct CORE *Self = CURRENT_CORE();
+  struct CORE *C;
+
+  if (Task == NULL) { return; }
+  if (Task == TaskCurrent && OSRunning) { TaskExit(); }
+  ENTER_CRITICAL();
+  C = NEST_TASK(Task);
+#if SMP_CORES > 1
+  // Another core's current task may be executing right now; that core reaps it
+  // once it is back in SwitchTask.
+  if (OSRunning && Task == C->Current) {
+    Task->Doomed = TRUE;
+    UNNEST_CORE(C);
+    EXIT_CRITICAL();
+    return;
+  }
+#endif
+  ReapTask(Task);
+  UNNEST_CORE(C);
+  EXIT_CRITICAL();
+}
+
+#if SMP_CORES > 1
+void SetTaskAffinity(struct TASK *Task, BYTE Core)
+{
+  struct CORE *C;
+
+  if (Task == NULL) { return; }
+  if (Core >= SMP_CORES) { Core = TASK_ANY_CORE; }
+  C = LOCK_TASK(Task);
+  Task->Affinity = Core;
+  UNLOCK_CORE(C);
+  // A task can only change rings while no core is executing it; otherwise its
+  // current core hands it over the next time SwitchTask passes over it.
+  if (Core != TASK_ANY_CORE) { MoveTask(Task, Core, NULL); }
+}
+
+// Entry point of every dispatch on SMP builds. SwitchTask enters the task while
+// holding its core's lock; the task must drop it before running user code.
+static WORD TaskEntry(WORD MsgType, WORD sParam, LONG lParam)
+{
+  struct CORE *Self = CURRENT_CORE();
+  WORD (*Func)(WORD MsgType, WORD sParam, LONG lParam) = TaskCurrent->Func;
+
+  UNLOCK_CORE(Self);
+  return Func(MsgType, sParam, lParam);
+}
+
+// Locks the core whose ring Task is on. Task->Core only changes under that lock,
+// so it is read again once the lock is held.
+static struct CORE *NestTask(struct TASK *Task)
+{
+  struct CORE *C;
+
+  for (;;) {
+    C = &Cores[Task->Core];
+    NEST_CORE(C);
+    if (C == &Cores[Task->Core]) { return C; }
+    UNNEST_CORE(C);
+  }
+}
+
+// Takes the locks of two rings (A may be B) in index order, masking interrupts
+static void LockCores(struct CORE *A, struct CORE *B)
+{
+  struct CORE *First = (A < B) ? A : B;
+  struct CORE *Second = (A < B) ? B : A;
+
+  LOCK_CORE(First);
+  if (Second != First) { NEST_CORE(Second); }
+}
+
+static void UnlockCores(struct CORE *A, struct CORE *B)
+{
+  struct CORE *First = (A < B) ? A : B;
+  struct CORE *Second = (A < B) ? B : A;
+
+  if (Second != First) { UNNEST_CORE(Second); }
+  UNLOCK_CORE(First);
+}
+
+// Moves Task to Core's ring if it is still pinned there and cannot be executing:
+// it is not the current task of its core, or that core is Self, the caller's own
+// scheduler. Called without locks held.
+static void MoveTask(struct TASK *Task, BYTE Core, struct CORE *Self)
+{
+  struct CORE *From;
+  struct CORE *To = &Cores[Core];
+
+  for (;;) {
+    From = &Cores[Task->Core];
+    LockCores(From, To);
+    if (From == &Cores[Task->Core]) { break; }
+    UnlockCores(From, To);
+  }
+  if (Task->Affinity == Core && From != To && (Task != From->Current || From == Self)) {
+    UnlinkTask(Task);
+    LinkTask(Task, Core);
+  }
+  UnlockCores(From, To);
+}
+
+// Called by an idle core, without locks held: takes over one ready, unpinned task
+// from another core's ring. Tasks that are some core's current task are left
+// alone, as they may be executing.
+static bool StealTask(struct CORE *Self)
+{
+  BYTE Me = (BYTE)(Self - Cores);
+  BYTE Offset;
+  struct CORE *Victim;
+  struct TASK *Anchor;
+  struct TASK *Task;
+
+  for (Offset = 1; Offset < SMP_CORES; Offset++) {
+    Victim = &Cores[(Me + Offset) % SMP_CORES];
+    // A ring of one only holds its current task. Read without the lock, so idle
+    // cores keep off the locks of cores that have nothing to give.
+    if (Victim->Count < 2) { continue; }
+    LockCores(Self, Victim);
+    Anchor = Victim->Current;
+    if (Anchor != NULL) {
+      for (Task = NEXT_TASK(Anchor); Task != Anchor; Task = NEXT_TASK(Task)) {
+        if (Task->Affinity == TASK_ANY_CORE && !Task->Doomed && TaskReady(Task)) {
+          UnlinkTask(Task);
+          LinkTask(Task, Me);
+          UnlockCores(Self, Victim);
+          return TRUE;
+        }
       }
-      // else, still sleeping, loop again with interrupts enabled at end
     }
+    UnlockCores(Self, Victim);
+  }
+  return FALSE;
+}
+#endif
 
-    // Check if task is ready to run (not sleeping AND has a message OR timer flag)
-    // Note: A task woken by timer (TimerFlag=TRUE, Sleeping=FALSE) will be handled here.
-    if (!TaskCurrent->Sleeping && (TaskCurrent->MsgCount != 0 || TaskCurrent->TimerFlag))
-    {
-      // If it was a timer event that made it runnable, clear the flag.
-      // Message events are handled by the task itself by reading its queue.
-      // The task function needs to be aware of how it was woken.
-      // For now, SwitchTask still manages MsgQueueOut and MsgCount for message events.
-      if (TaskCurrent->MsgCount != 0) {
-          // struct MSG *current_msg = TaskCurrent->MsgQueueOut; // Task will read this
-          // K_HAL_InitTaskStack passed MSG_TYPE_INIT. Subsequent dispatches for messages
-          // mean the task needs to check its own queue.
-          // We still manage the OS view of the queue here:
-          if (++TaskCurrent->MsgQueueOut >= TaskCurrent->MsgQueueEnd) {
-              TaskCurrent->MsgQueueOut = TaskCurrent->MsgQueue;
-          }
-          --TaskCurrent->MsgCount;
-      }
-      // If woken by timer, TimerFlag is true. Task function can check TaskCurrent->TimerFlag.
-      // Clear it after task has had a chance to see it or it's for this dispatch.
-      // This is tricky: if task yields, TimerFlag might be set again by ISR.
-      // Let's clear TimerFlag before dispatch if it's the reason for running.
-      // The task function will have to infer if it was a timer event if MsgCount was 0.
-      if (TaskCurrent->MsgCount == 0 && TaskCurrent->TimerFlag) {
-          // TaskCurrent->TimerFlag = FALSE; // Task will see it true, then OS clears after processing return
-      }
+void TaskExit(void)
+{
+  struct CORE *Self = CURRENT_CORE();
 
+  // The task's stack is still in use until we are back on OS_SP, so SwitchTask does the reaping
+  LOCK_CORE(Self);
+  TaskExiting = TRUE;
+  K_HAL_ContextSwitch(&(TaskCurrent->StackPtr), OS_SP);
 
-      // --- Switch to Task Context ---
-      // OS_SP (global) will be updated by K_HAL_ContextSwitch with current OS SP.
-      // TaskCurrent->StackPtr is the SP for the task to run.
-      K_HAL_ContextSwitch(&OS_SP, TaskCurrent->StackPtr);
-      // --- Execution resumes here in OS context when TaskCurrent yields back ---
-      // Interrupts are assumed disabled by K_HAL_ContextSwitch on return to OS.
+  Emergency("TaskExit_CtxSwitch_Failed");
+  while(1); // A reaped task is never switched back to
+}
 
-      Delay = g_LastTaskReturnValue; // Get the task's desired sleep time
-
-      // Process task's return value (Delay)
-      if (Delay == 0) { TaskCurrent->TimerFlag = TRUE; TaskCurrent->Timer = 0;} // Yield
-      else if (Delay == MSG_WAIT) { TaskCurrent->Timer = 0; TaskCurrent->TimerFlag = FALSE; } // Wait indefinitely
-      else { TaskCurrent->Timer = Delay; TaskCurrent->TimerFlag = FALSE; } // Sleep for duration
-
-      // If task was run due to timer, clear the flag *after* processing its Delay,
-      // as Delay might be 0 (yield) which sets TimerFlag again.
-      // The task itself should check and consume its TimerFlag if needed.
-      // For now, if it was run for a timer, the timer is now reset or task is sleeping.
-      // The original logic reset TimerFlag before calling Func. If it was timer event,
-      // the task knew. Now it's less direct.
-      // Let's assume K_HAL_InitTaskStack passes MSG_TYPE_TIMER if TimerFlag was the cause.
-      // No, that's not how we set it up. Task must check its flags.
-      // If TimerFlag was true and MsgCount was 0, then it ran due to timer.
-      // The task itself should clear its TimerFlag after processing the timer event.
-      // For now, SwitchTask has already reset it before this point if it was the cause.
-      // This part of the logic for how a task knows *why* it ran (message vs timer)
-      // when Func is no longer directly passed MsgType needs care in task design.
-      // The current model: InitTask primes with MSG_TYPE_INIT.
-      // Subsequent runs: task checks its queue, checks its TimerFlag.
-    }
-    // else, task is sleeping and timer hasn't fired, OR task is not sleeping but no events.
+void RunOS(void)
+{
+  struct CORE *Self = CURRENT_CORE();
 
-    K_HAL_EnableInterrupts();
+  if (Cores[0].Current == NULL) {
+    Emergency("RunOS: No tasks initialized prior to starting OS!");
+    while(1);
   }
+#if SIM_TIME
+  // The simulator owns the clock: run until no task can ever become ready again
+  K_HAL_StartScheduler(TaskCurrent->StackPtr);
+  SimRun(0x7fffffffL - TickCount);
+#else
+  K_HAL_InitSystemTimer(key_timer_irq_handler);
+  K_HAL_StartScheduler(TaskCurrent->StackPtr);
+#if SMP_CORES > 1
+  K_HAL_StartCores(SwitchTask);
+#endif
+  SwitchTask();
+  Emergency("RunOS: SwitchTask returned unexpectedly!");
+  while(1);
+#endif
 }
 
-INT Sleep(WORD Delay, bool TaskSwitchPermit)
+// Empties Task's queue. The lock of Task's core must be held.
+static void ResetQueue(struct TASK *Task)
+{
+#if COMPACT_TCB
+  Task->MsgQueueIn = 0;
+  Task->MsgQueueOut = 0;
+#else
+  Task->MsgQueueIn = Task->MsgQueue;
+  Task->MsgQueueOut = Task->MsgQueue;
+  Task->MsgQueueEnd = Task->MsgQueue + Task->QueueCapacity;
+#endif
+  Task->MsgCount = 0;
+}
+
+// Appends a message to Task's queue. The lock of Task's core must be held.
+#if EDF_SCHED
+static bool PutMsgDeadline(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam, LONG Deadline)
+#else
+static bool PutMsg(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam)
+#endif
 {
-  K_HAL_DisableInterrupts();
+  struct MSG *Msg;
+  if (Task->MsgCount >= Task->QueueCapacity) { return false; }
+#if COMPACT_TCB
+  Msg = &Task->MsgQueue[Task->MsgQueueIn];
+  if (++Task->MsgQueueIn >= Task->QueueCapacity) { Task->MsgQueueIn = 0; }
+#else
+  Msg = Task->MsgQueueIn;
+  if (++Task->MsgQueueIn >= Task->MsgQueueEnd) { Task->MsgQueueIn = Task->MsgQueue; }
+#endif
+  Msg->MsgType = MsgType;
+  Msg->sParam = sParam;
+  Msg->lParam = lParam;
+  ++Task->MsgCount;
+#if EDF_SCHED
+  Msg->Deadline = Deadline;
+  EdfUpdate(Task);
+#endif
+  return true;
+}
 
-  TaskCurrent->Sleeping = TRUE;
-  TaskCurrent->WakeUpType = 0;
-  if (Delay == 0) {
-    TaskCurrent->TimerFlag = TRUE;
-    TaskCurrent->Timer = 0;
-  } else if (Delay == MSG_WAIT) {
-    TaskCurrent->Timer = 0;
+// Oldest message on Task's queue, which must not be empty
+static struct MSG *PeekMsg(struct TASK *Task)
+{
+#if COMPACT_TCB
+  return &Task->MsgQueue[Task->MsgQueueOut];
+#else
+  return Task->MsgQueueOut;
+#endif
+}
+
+// Takes the oldest message off Task's queue, which must not be empty. The lock of
+// Task's core must be held.
+static void GetMsg(struct TASK *Task, struct MSG *Msg)
+{
+  *Msg = *PeekMsg(Task);
+#if COMPACT_TCB
+  if (++Task->MsgQueueOut >= Task->QueueCapacity) { Task->MsgQueueOut = 0; }
+#else
+  if (++Task->MsgQueueOut >= Task->MsgQueueEnd) { Task->MsgQueueOut = Task->MsgQueue; }
+#endif
+  --Task->MsgCount;
+}
+
+bool SendMsg(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam)
+{
+  struct CORE *C;
+  bool Sent;
+  if (Task) {
+    C = LOCK_TASK(Task);
+    Sent = PutMsg(Task, MsgType, sParam, lParam);
+    UNLOCK_CORE(C);
+    return Sent;
+  }
+  return false;
+}
+
+#if EDF_SCHED
+bool SendMsgDeadline(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam, LONG Deadline)
+{
+  bool Sent;
+  if (Task) {
+    ENTER_CRITICAL();
+    Sent = PutMsgDeadline(Task, MsgType, sParam, lParam, Deadline);
+    EXIT_CRITICAL();
+    return Sent;
+  }
+  return false;
+}
+
+void SetTaskPeriod(struct TASK *Task, WORD Period, WORD Deadline)
+{
+  if (Task == NULL) { return; }
+  ENTER_CRITICAL();
+  if (Deadline == 0) { Deadline = Period ? Period : EDF_DEFAULT_DEADLINE; }
+  Task->RelDeadline = Deadline;
+  Task->Period = Period;
+  if (Period) {
+    Task->ReleaseTimer = Period;
+    ReleaseTask(Task, TickCount);
+  }
+  EXIT_CRITICAL();
+}
+
+WORD GetDeadlineMisses(struct TASK *Task)
+{
+  return Task ? Task->DeadlineMisses : 0;
+}
+
+// Starts a periodic job released at When. A release that finds the previous one
+// still waiting, or still running, is a miss; the two jobs then become one, due
+// at the later deadline. Must be called inside a critical section.
+static void ReleaseTask(struct TASK *Task, LONG When)
+{
+  if (Task->Sleeping) {
+    ++Task->DeadlineMisses;
+    Task->JobDeadline = When + Task->RelDeadline;
   } else {
-    TaskCurrent->Timer = Delay;
+    if (Task->TimerFlag) { ++Task->DeadlineMisses; }
+    Task->TimerFlag = TRUE;
+    Task->TimerDeadline = When + Task->RelDeadline;
   }
-  MultiTask = TaskSwitchPermit;
+  EdfUpdate(Task);
+}
 
-  K_HAL_ContextSwitch(&(TaskCurrent->StackPtr), OS_SP);
+static void HeapPlace(BYTE Index, struct TASK *Task)
+{
+  ReadyHeap[Index] = Task;
+  Task->HeapIndex = Index;
+}
 
-  MultiTask = TRUE;
-  K_HAL_EnableInterrupts();
-  return TaskCurrent->WakeUpType;
+static void HeapUp(struct TASK *Task)
+{
+  BYTE Index = Task->HeapIndex;
+  BYTE Parent;
+
+  while (Index > 0) {
+    Parent = (BYTE)((Index - 1) / 2);
+    if (!DEADLINE_BEFORE(Task->Deadline, ReadyHeap[Parent]->Deadline)) { break; }
+    HeapPlace(Index, ReadyHeap[Parent]);
+    Index = Parent;
+  }
+  HeapPlace(Index, Task);
 }
 
-void key_timer_irq_handler()
+static void HeapDown(struct TASK *Task)
 {
-  struct TASK *Task;
-  Task = TaskCurrent;
-  if (!Task) return; // Should not happen if OS is running
-  do {
-    if (Task->Timer) {
-      if (--Task->Timer == 0) {
-        Task->TimerFlag = TRUE;
-      }
+  BYTE Index = Task->HeapIndex;
+  BYTE Child;
+
+  while ((Child = (BYTE)(2 * Index + 1)) < ReadyCount) {
+    if (Child + 1 < ReadyCount &&
+        DEADLINE_BEFORE(ReadyHeap[Child + 1]->Deadline, ReadyHeap[Child]->Deadline)) {
+      ++Child;
     }
-    Task = Task->TaskNext;
-  } while (Task != TaskCurrent);
-}
\ No newline at end of file
+    if (!DEADLINE_BEFORE(ReadyHeap[Child]->Deadline, Task->Deadline)) { break; }
+    HeapPlace(Index, ReadyHeap[Child]);
+    Index = Child;
+  }
+  HeapPlace(Index, Task);
+}
+
+// TRUE if Task's next dispatch is its oldest message rather than its timer wake-up
+static bool MsgFirst(struct TASK *Task)
+{
+  if (Task->MsgCount == 0) { return FALSE; }
+  return !Task->TimerFlag || !DEADLINE_BEFORE(Task->TimerDeadline, PeekMsg(Task)->Deadline);
+}
+
+// Re-keys Task in the ready heap, inserting or removing it as TaskReady() now says.
+// Called inside a critical section after anything that may change that answer or
+// Task's earliest deadline. O(log n).
+static void EdfUpdate(struct TASK *Task)
+{
+  struct TASK *Last;
+  BYTE Index = Task->HeapIndex;
+
+  if (!TaskReady(Task)) {
+    if (Index == HEAP_NONE) { return; }
+    Task->HeapIndex = HEAP_NONE;
+    Last = ReadyHeap[--ReadyCount];
+    if (Last != Task) {
+      HeapPlace(Index, Last);
+      HeapUp(Last);
+      HeapDown(Last);
+    }
+    return;
+  }
+
+  if (Task->Sleeping) {
+    Task->Deadline = Task->JobDeadline;
+  } else if (MsgFirst(Task)) {
+    Task->Deadline = PeekMsg(Task)->Deadline;
+  } else {
+    Task->Deadline = Task->TimerDeadline;
+  }
+  if (Index == HEAP_NONE) {
+    if (ReadyCount >= MAX_TASKS) { Emergency("EDF heap full"); }
+    HeapPlace(ReadyCount++, Task);
+  }
+  HeapUp(Task);
+  HeapDown(Task);
+}
+#endif
+
+#if MSG_TOPICS
+struct TOPIC *InitTopic(BYTE MaxSubscribers)
+{
+  struct TOPIC *Topic;
+
+  Topic = (struct TOPIC *)malloc(sizeof(struct TOPIC));
+  if (Topic == NULL) { Emergency("Topic Failed"); }
+  Topic->Subscribers = (struct SUBSCRIBER *)calloc(MaxSubscribers, sizeof(struct SUBSCRIBER));
+  if (Topic->Subscribers == NULL) { Emergency("Subscribers Failed"); }
+  Topic->SubscriberCount = 0;
+  Topic->MaxSubscribers = MaxSubscribers;
+
+  ENTER_CRITICAL();
+  Topic->TopicNext = TopicList;
+  TopicList = Topic;
+  EXIT_CRITICAL();
+  return Topic;
+}
+
+bool Subscribe(struct TOPIC *Topic, struct TASK *Task)
+{
+  struct SUBSCRIBER *Sub;
+  BYTE i;
+
+  if (!Topic || !Task) { return false; }
+  ENTER_CRITICAL();
+  for (i = 0; i < Topic->SubscriberCount; i++) {
+    if (Topic->Subscribers[i].Task == Task) {
+      EXIT_CRITICAL();
+      return true;
+    }
+  }
+  if (Topic->SubscriberCount >= Topic->MaxSubscribers) {
+    EXIT_CRITICAL();
+    return false;
+  }
+  Sub = &Topic->Subscribers[Topic->SubscriberCount++];
+  Sub->Task = Task;
+  Sub->Dropped = 0;
+  EXIT_CRITICAL();
+  return true;
+}
+
+// Interrupts must be disabled. Order of delivery is not preserved across removals.
+static void RemoveSubscriber(struct TOPIC *Topic, struct TASK *Task)
+{
+  BYTE i;
+  for (i = 0; i < Topic->SubscriberCount; i++) {
+    if (Topic->Subscribers[i].Task == Task) {
+      Topic->Subscribers[i] = Topic->Subscribers[--Topic->SubscriberCount];
+      return;
+    }
+  }
+}
+
+void Unsubscribe(struct TOPIC *Topic, struct TASK *Task)
+{
+  if (!Topic || !Task) { return; }
+  ENTER_CRITICAL();
+  RemoveSubscriber(Topic, Task);
+  EXIT_CRITICAL();
+}
+
+BYTE Publish(struct TOPIC *Topic, WORD MsgType, WORD sParam, LONG lParam)
+{
+  struct SUBSCRIBER *Sub;
+  struct SUBSCRIBER *End;
+  struct CORE *C;
+  BYTE Delivered = 0;
+
+  if (!Topic) { return 0; }
+  // One critical section for the whole fan-out, so every subscriber sees the
+  // event at the same point relative to its other messages.
+  ENTER_CRITICAL();
+  End = Topic->Subscribers + Topic->SubscriberCount;
+  for (Sub = Topic->Subscribers; Sub < End; Sub++) {
+    C = NEST_TASK(Sub->Task);
+    if (PutMsg(Sub->Task, MsgType, sParam, lParam)) { ++Delivered; }
+    else { ++Sub->Dropped; }
+    UNNEST_CORE(C);
+  }
+  EXIT_CRITICAL();
+  return Delivered;
+}
+
+WORD GetTopicDropped(struct TOPIC *Topic, struct TASK *Task)
+{
+  WORD Dropped = 0;
+  BYTE i;
+
+  if (!Topic) { return 0; }
+  ENTER_CRITICAL();
+  for (i = 0; i < Topic->SubscriberCount; i++) {
+    if (Topic->Subscribers[i].Task == Task) { Dropped = Topic->Subscribers[i].Dropped; }
+  }
+  EXIT_CRITICAL();
+  return Dropped;
+}
+#endif
+
+#if BYTE_STREAMS
+// Producer and consumer each own one free-running index, so the byte path needs no
+// critical section; the barrier only orders the data copy against the index update.
+// On one core that is a compiler barrier; across cores it must be a memory fence.
+// The writer also owns LastWrite. The lock is only taken to send the reader its
+// message (writer, StreamTick) and to take it back (reader, clearing Notified).
+#if SMP_CORES > 1
+#define STREAM_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define STREAM_BARRIER() __asm volatile ("" ::: "memory")
+#endif
+
+struct STREAM *InitStream(WORD Size, struct TASK *Reader, WORD MsgType,
+                          WORD Trigger, WORD IdleTimeout)
+{
+  struct STREAM *Stream;
+
+  // A power of two keeps the index masking cheap; free-running WORD indices
+  // need Size <= 0x8000 for Head - Tail to stay unambiguous.
+  if (Size == 0 || (Size & (Size - 1)) || Size > 0x8000) { Emergency("Stream Size"); }
+  Stream = (struct STREAM *)malloc(sizeof(struct STREAM));
+  if (Stream == NULL) { Emergency("Stream Failed"); }
+  Stream->Buffer = (BYTE *)malloc(Size);
+  if (Stream->Buffer == NULL) { Emergency("Stream Buffer Failed"); }
+
+  Stream->Size = Size;
+  Stream->Head = 0;
+  Stream->Tail = 0;
+  Stream->Trigger = Trigger ? Trigger : 1;
+  Stream->IdleTimeout = IdleTimeout;
+  Stream->LastWrite = 0;
+  Stream->Notified = FALSE;
+  Stream->Reader = Reader;
+  Stream->MsgType = MsgType;
+
+  ENTER_CRITICAL();
+  Stream->StreamNext = StreamList;
+  StreamList = Stream;
+  EXIT_CRITICAL();
+  return Stream;
+}
+
+// Sends the reader one message per batch: nothing more is sent until the reader
+// has consumed data. The kernel lock must be held.
+static void NotifyReader(struct STREAM *Stream)
+{
+  struct CORE *C;
+
+  if (!Stream->Notified && Stream->Reader) {
+    C = NEST_TASK(Stream->Reader);
+    Stream->Notified = PutMsg(Stream->Reader, Stream->MsgType, 0,
+                              (LONG)(WORD)(Stream->Head - Stream->Tail));
+    UNNEST_CORE(C);
+  }
+}
+
+WORD StreamCount(struct STREAM *Stream)
+{
+  return (WORD)(Stream->Head - Stream->Tail);
+}
+
+WORD StreamWriteRegion(struct STREAM *Stream, BYTE **Region)
+{
+  WORD Start = Stream->Head & (Stream->Size - 1);
+  WORD Free = Stream->Size - (WORD)(Stream->Head - Stream->Tail);
+
+  *Region = Stream->Buffer + Start;
+  return (Free < Stream->Size - Start) ? Free : (WORD)(Stream->Size - Start);
+}
+
+void StreamCommitWrite(struct STREAM *Stream, WORD Len)
+{
+  if (Len == 0) { return; }
+  // Stamped first, so StreamTick never sees the new bytes with the old time
+  if (Stream->IdleTimeout) { Stream->LastWrite = (WORD)TickCount; }
+  STREAM_BARRIER(); // Data must be in the buffer before the reader can see it
+  Stream->Head += Len;
+  STREAM_BARRIER(); // Head before Notified; StreamCommitRead does the reverse
+
+  // A pending message already covers these bytes: the reader re-checks the count
+  // when it takes the message back
+  if (!Stream->Notified && (WORD)(Stream->Head - Stream->Tail) >= Stream->Trigger) {
+    ENTER_CRITICAL();
+    NotifyReader(Stream);
+    EXIT_CRITICAL();
+  }
+}
+
+WORD StreamWrite(struct STREAM *Stream, const BYTE *Data, WORD Len)
+{
+  WORD Start = Stream->Head & (Stream->Size - 1);
+  WORD Free = Stream->Size - (WORD)(Stream->Head - Stream->Tail);
+  WORD Chunk;
+
+  if (Len > Free) { Len = Free; }
+  // At most two copies: up to the end of the buffer, then from its start
+  Chunk = Stream->Size - Start;
+  if (Chunk > Len) { Chunk = Len; }
+  memcpy(Stream->Buffer + Start, Data, Chunk);
+  memcpy(Stream->Buffer, Data + Chunk, Len - Chunk);
+  StreamCommitWrite(Stream, Len);
+  return Len;
+}
+
+WORD StreamReadRegion(struct STREAM *Stream, BYTE **Region)
+{
+  WORD Start = Stream->Tail & (Stream->Size - 1);
+  WORD Count = (WORD)(Stream->Head - Stream->Tail);
+
+  STREAM_BARRIER(); // Head must be read before the data it covers
+  *Region = Stream->Buffer + Start;
+  return (Count < Stream->Size - Start) ? Count : (WORD)(Stream->Size - Start);
+}
+
+void StreamCommitRead(struct STREAM *Stream, WORD Len)
+{
+  STREAM_BARRIER(); // Finish with the data before handing the space back
+  Stream->Tail += Len;
+  if (!Stream->Notified) { return; } // Nothing to take back
+
+  // Re-arm notification; if a full batch is already waiting, ask for another dispatch.
+  // A remainder below the trigger (e.g. the far side of a wrapped write read through
+  // StreamReadRegion) is left to StreamTick, which reports it IdleTimeout ticks
+  // after the write that brought it.
+  ENTER_CRITICAL();
+  Stream->Notified = FALSE;
+  STREAM_BARRIER(); // Notified before Head; StreamCommitWrite does the reverse
+  if ((WORD)(Stream->Head - Stream->Tail) >= Stream->Trigger) { NotifyReader(Stream); }
+  EXIT_CRITICAL();
+}
+
+WORD StreamRead(struct STREAM *Stream, BYTE *Data, WORD Len)
+{
+  WORD Start = Stream->Tail & (Stream->Size - 1);
+  WORD Count = (WORD)(Stream->Head - Stream->Tail);
+  WORD Chunk;
+
+  if (Len > Count) { Len = Count; }
+  STREAM_BARRIER(); // Head must be read before the data it covers
+  Chunk = Stream->Size - Start;
+  if (Chunk > Len) { Chunk = Len; }
+  memcpy(Data, Stream->Buffer + Start, Chunk);
+  memcpy(Data + Chunk, Stream->Buffer, Len - Chunk);
+  if (Len) { StreamCommitRead(Stream, Len); }
+  return Len;
+}
+
+// TRUE if the stream holds bytes nobody has reported yet, waiting for the idle
+// timeout: IdleTimeout ticks after LastWrite
+static bool StreamIdling(struct STREAM *Stream)
+{
+  return Stream->IdleTimeout && Stream->Reader && !Stream->Notified &&
+         Stream->Head != Stream->Tail;
+}
+
+// Called from AdvanceTime with the kernel lock held: wakes readers whose data has
+// sat below the trigger level for IdleTimeout ticks.
+static void StreamTick(void)
+{
+  struct STREAM *Stream;
+
+  for (Stream = StreamList; Stream; Stream = Stream->StreamNext) {
+    if (StreamIdling(Stream) &&
+        (WORD)((WORD)TickCount - Stream->LastWrite) >= Stream->IdleTimeout) {
+      NotifyReader(Stream);
+    }
+  }
+}
+#endif
+
+void WakeUp(struct TASK *Task, INT WakeUpType)
+{
+  struct CORE *C;
+
+  if (Task) {
+    C = LOCK_TASK(Task);
+    if ((Task->Sleeping) && (!Task->TimerFlag)) {
+      Task->TimerFlag = TRUE;
+      Task->WakeUpType = WakeUpType;
+#if EDF_SCHED
+      EdfUpdate(Task);
+#endif
+    }
+    UNLOCK_CORE(C);
+  }
+}
+
+LONG GetTicks(void)
+{
+  LONG Ticks;
+  ENTER_CRITICAL(); // LONG may take several accesses on small cores
+  Ticks = TickCount;
+  EXIT_CRITICAL();
+  return Ticks;
+}
+
+#if TASK_BUDGETS
+void SetTaskBudget(struct TASK *Task, WORD Budget)
+{
+  if (Task) { Task->Budget = Budget; }
+}
+
+void SetBudgetHook(void (*Hook)(struct TASK *Task, WORD Ticks))
+{
+  ENTER_CRITICAL();
+  BudgetHook = Hook;
+  EXIT_CRITICAL();
+}
+
+bool GetLastOverrun(struct OVERRUN *Overrun)
+{
+  bool Seen;
+  LOCK(&OverrunLock);
+  Seen = OverrunSeen;
+  if (Seen && Overrun) { *Overrun = LastOverrun; }
+  UNLOCK(&OverrunLock);
+  return Seen;
+}
+
+// Called with the core's lock held each time a dispatch hands the CPU back to
+// SwitchTask, whether the task function returned or the task called Sleep().
+static void CheckBudget(struct CORE *Self)
+{
+  struct TASK *Task = TaskCurrent;
+  WORD Ticks = (WORD)(TickCount - DispatchStart);
+
+  TaskRunning = NULL;
+  if (Task->Budget == 0 || Ticks <= Task->Budget) { return; }
+
+  ++Task->OverrunCount;
+  Task->LastOverrun.TaskID = Task->TaskID;
+  Task->LastOverrun.MsgType = DispatchMsg.MsgType;
+  Task->LastOverrun.Ticks = Ticks;
+  NEST(&OverrunLock);
+  LastOverrun = Task->LastOverrun;
+  OverrunSeen = TRUE;
+  UNNEST(&OverrunLock);
+#if DEBUG
+  DebugPrintf("Task '%c' overran its budget: %u ticks on msg %u.\n",
+              Task->TaskID, Ticks, DispatchMsg.MsgType);
+#endif
+}
+#endif
+
+#if SIM_TIME
+// Called by SwitchTask when a whole round found nothing to run. Nothing can become
+// ready before the next timer expiry, so the clock jumps straight there instead of
+// ticking through the idle period. Returns FALSE when the run should stop.
+static bool SimIdle(void)
+{
+  struct CORE *Self = CURRENT_CORE();
+  struct TASK *Task = TaskCurrent;
+  LONG Jump = SimStopAt - TickCount;
+
+  do {
+    if (Task->Timer && Task->Timer < Jump) { Jump = Task->Timer; }
+#if EDF_SCHED
+    if (Task->Period && Task->ReleaseTimer < Jump) { Jump = Task->ReleaseTimer; }
+#endif
+    Task = NEXT_TASK(Task);
+  } while (Task != TaskCurrent);
+#if BYTE_STREAMS
+  {
+    struct STREAM *Stream;
+    WORD Idle;
+    for (Stream = StreamList; Stream; Stream = Stream->StreamNext) {
+      if (!StreamIdling(Stream)) { continue; }
+      Idle = (WORD)((WORD)TickCount - Stream->LastWrite);
+      if (Idle < Stream->IdleTimeout && Stream->IdleTimeout - Idle < Jump) {
+        Jump = Stream->IdleTimeout - Idle;
+      }
+    }
+  }
+#endif
+
+  while (Jump > 0) {
+    WORD Step = (Jump > 0xfffe) ? 0xfffe : (WORD)Jump;
+    AdvanceTime(Step);
+    Jump -= Step;
+  }
+  return TickCount < SimStopAt;
+}
+
+static void SimRecord(void)
+{
+  struct CORE *Self = CURRENT_CORE();
+  struct SIM_EVENT *Event = &SimEvents[SimDispatchCount % SIM_TIMELINE_SIZE];
+
+  Event->Start = DispatchStart;
+  Event->Ticks = (WORD)(TickCount - DispatchStart);
+  Event->MsgType = DispatchMsg.MsgType;
+  Event->TaskID = TaskCurrent->TaskID;
+  ++SimDispatchCount;
+}
+
+void SimRun(LONG Ticks)
+{
+  struct CORE *Self = CURRENT_CORE();
+
+  if (TaskCurrent == NULL) { return; }
+  ENTER_CRITICAL();
+  SimStopAt = TickCount + Ticks;
+  EXIT_CRITICAL();
+  SwitchTask();
+}
+
+void SimConsume(WORD Ticks)
+{
+  ENTER_CRITICAL();
+  AdvanceTime(Ticks);
+  EXIT_CRITICAL();
+}
+
+WORD SimTimeline(struct SIM_EVENT *Events, WORD Max)
+{
+  LONG First = 0;
+  WORD Count;
+
+  if (SimDispatchCount > SIM_TIMELINE_SIZE) { First = SimDispatchCount - SIM_TIMELINE_SIZE; }
+  for (Count = 0; Count < Max && First + Count < SimDispatchCount; Count++) {
+    Events[Count] = SimEvents[(First + Count) % SIM_TIMELINE_SIZE];
+  }
+  return Count;
+}
+
+LONG SimDispatches(void)
+{
+  return SimDispatchCount;
+}
+#endif
+
+// TRUE if SwitchTask would dispatch Task. Must be called inside a critical section.
+static bool TaskReady(struct TASK *Task)
+{
+  if (Task->Sleeping) { return Task->TimerFlag; }
+  return Task->MsgCount != 0 || Task->TimerFlag;
+}
+
+// Scheduler loop. Runs on the stack RunOS() was called from (on SMP builds, once
+// per core on the stack K_HAL_StartCores gave it); each dispatch saves that
+// context into OS_SP and the task comes back to it by returning (through
+// DefaultTaskExitHandler), by calling Sleep() or by calling TaskExit().
+static void SwitchTask()
+{
+  struct CORE *Self = CURRENT_CORE(); // A scheduler never leaves its core
+  WORD Delay;            // Will be set by g_LastTaskReturnValue
+  bool Dispatch;
+  bool Reap;
+#if EDF_SCHED
+  bool Released;
+#endif
+#if SIM_TIME || SMP_CORES > 1
+  int IdleRounds = 0;
+#endif
+#if SMP_CORES > 1
+  bool Idle;
+#endif
+
+  ENTER_CRITICAL();
+  OSRunning = TRUE;
+  NEST_CORE(Self);
+  MultiTask = TRUE;
+  UNNEST_CORE(Self);
+  EXIT_CRITICAL();
+
+  while (TRUE)
+  {
+    LOCK_CORE(Self);
+#if SIM_TIME
+    if (TickCount >= SimStopAt) {
+      UNLOCK_CORE(Self);
+      return;
+    }
+#endif
+#if SMP_CORES > 1
+    if (TaskCurrent == NULL) {
+      UNLOCK_CORE(Self);
+      if (!StealTask(Self)) { K_HAL_CoreIdle(); }
+      continue;
+    }
+#endif
+    if (MultiTask)
+    {
+#if EDF_SCHED
+      if (ReadyCount == 0) {
+        // Nothing can run before the next tick, message or release
+#if SIM_TIME
+        if (!SimIdle()) {
+          UNLOCK_CORE(Self);
+          return;
+        }
+#endif
+        UNLOCK_CORE(Self);
+        continue;
+      }
+      TaskCurrent = ReadyHeap[0];
+#else
+      TaskCurrent = NEXT_TASK(TaskCurrent);
+#endif
+    }
+#if SMP_CORES > 1
+    if (TaskCurrent->Doomed) {
+      UNLOCK_CORE(Self);
+      ReapCurrent(Self);
+      continue;
+    }
+    if (TaskCurrent->Affinity != TASK_ANY_CORE && TaskCurrent->Affinity != TaskCurrent->Core) {
+      // Pinned elsewhere by SetTaskAffinity while it was our current task
+      struct TASK *Task = TaskCurrent;
+      BYTE Core = Task->Affinity;
+      UNLOCK_CORE(Self);
+      MoveTask(Task, Core, Self);
+      continue;
+    }
+#endif
+
+    Dispatch = FALSE;
+    Reap = FALSE;
+#if SMP_CORES > 1
+    Idle = FALSE;
+#endif
+    if (TaskCurrent->Sleeping)
+    {
+      if (TaskCurrent->TimerFlag) // Sleep() timed out or WakeUp() was called
+      {
+        TaskCurrent->Timer = 0;
+        TaskCurrent->TimerFlag = FALSE;
+        TaskCurrent->Sleeping = FALSE;
+        // Resume inside Sleep() on the task's own saved context
+        DispatchMsg.MsgType = MSG_TYPE_TIMER;
+#if EDF_SCHED
+        DispatchMsg.Deadline = TaskCurrent->JobDeadline;
+#endif
+        Dispatch = TRUE;
+      }
+      // else, still sleeping
+    }
+    else if (TaskReady(TaskCurrent))
+    {
+      // The task function is entered from the top for every message, or with
+      // MSG_TYPE_TIMER when the delay it returned last time has expired.
+#if EDF_SCHED
+      if (MsgFirst(TaskCurrent)) {
+#else
+      if (TaskCurrent->MsgCount != 0) {
+#endif
+        GetMsg(TaskCurrent, &DispatchMsg);
+      } else {
+        TaskCurrent->TimerFlag = FALSE;
+        DispatchMsg.MsgType = MSG_TYPE_TIMER;
+        DispatchMsg.sParam = 0;
+        DispatchMsg.lParam = 0L;
+#if EDF_SCHED
+        DispatchMsg.Deadline = TaskCurrent->TimerDeadline;
+#endif
+      }
+#if EDF_SCHED
+      TaskCurrent->JobDeadline = DispatchMsg.Deadline;
+#endif
+      TaskCurrent->StackPtr = K_HAL_InitTaskStack(TaskCurrent->StackBase,
+                                                  TaskCurrent->StackSize * sizeof(int32_t),
+#if SMP_CORES > 1
+                                                  TaskEntry,
+#else
+                                                  TaskCurrent->Func,
+#endif
+                                                  DefaultTaskExitHandler,
+                                                  DispatchMsg.MsgType,
+                                                  DispatchMsg.sParam,
+                                                  DispatchMsg.lParam);
+      Dispatch = TRUE;
+    }
+
+    if (Dispatch)
+    {
+#if EDF_SCHED
+      EdfUpdate(TaskCurrent); // Re-keyed on whatever work it has left
+#endif
+#if TASK_BUDGETS || SIM_TIME
+      DispatchStart = TickCount;
+#endif
+#if TASK_BUDGETS
+      BudgetHookFired = FALSE;
+      TaskRunning = TaskCurrent;
+#endif
+      TaskReturned = FALSE;
+#if KDOS_CONSOLE
+      ++Self->Dispatches;
+#endif
+
+      // --- Switch to Task Context ---
+      // OS_SP (global) will be updated by K_HAL_ContextSwitch with current OS SP.
+      // TaskCurrent->StackPtr is the SP for the task to run.
+      K_HAL_ContextSwitch(&OS_SP, TaskCurrent->StackPtr);
+      // --- Execution resumes here in OS context when TaskCurrent yields back ---
+      // Interrupts are assumed disabled by K_HAL_ContextSwitch on return to OS.
+#if TASK_BUDGETS
+      CheckBudget(Self);
+#endif
+#if SIM_TIME
+      SimRecord();
+#endif
+#if SIM_TIME || SMP_CORES > 1
+      IdleRounds = 0;
+#endif
+#if SMP_CORES > 1
+      if (TaskCurrent->Doomed) { TaskExiting = TRUE; }
+#endif
+      if (TaskExiting) {
+        TaskExiting = FALSE;
+        Reap = TRUE; // Once this core's lock is dropped: the kernel lock comes first
+      }
+      else if (TaskReturned)
+      {
+        Delay = g_LastTaskReturnValue; // Get the task's desired sleep time
+#if EDF_SCHED
+        // A periodic task's flag can only have been raised by a release that came
+        // in during this dispatch; that job is still to run whatever Delay says
+        Released = TaskCurrent->Period && TaskCurrent->TimerFlag;
+#endif
+
+        // Process task's return value (Delay)
+        if (Delay == 0) { TaskCurrent->TimerFlag = TRUE; TaskCurrent->Timer = 0;} // Yield
+        else if (Delay == MSG_WAIT) { TaskCurrent->Timer = 0; TaskCurrent->TimerFlag = FALSE; } // Wait indefinitely
+        else { TaskCurrent->Timer = Delay; TaskCurrent->TimerFlag = FALSE; } // Sleep for duration
+#if EDF_SCHED
+        if (DEADLINE_BEFORE(TaskCurrent->JobDeadline, TickCount)) { ++TaskCurrent->DeadlineMisses; }
+        if (Released) { TaskCurrent->TimerFlag = TRUE; }
+        else if (Delay == 0) { TaskCurrent->TimerDeadline = TickCount + TaskCurrent->RelDeadline; }
+        EdfUpdate(TaskCurrent);
+#endif
+      }
+      // else the task is inside Sleep(), which has already set its timer
+#if EDF_SCHED
+      else { EdfUpdate(TaskCurrent); }
+#endif
+    }
+#if SIM_TIME
+    else if (++IdleRounds >= TaskCount) {
+      IdleRounds = 0;
+      if (!SimIdle()) {
+        UNLOCK_CORE(Self);
+        return;
+      }
+    }
+#elif SMP_CORES > 1
+    else if (++IdleRounds >= TaskCount) {
+      IdleRounds = 0;
+      Idle = TRUE;
+    }
+#endif
+
+    UNLOCK_CORE(Self);
+    if (Reap) { ReapCurrent(Self); }
+#if SMP_CORES > 1
+    // A whole round with nothing ready here: look for work on the other cores,
+    // and if there is none, let the core rest until something happens
+    else if (Idle && !StealTask(Self)) { K_HAL_CoreIdle(); }
+#endif
+  }
+}
+
+INT Sleep(WORD Delay, bool TaskSwitchPermit)
+{
+  struct CORE *Self = CURRENT_CORE();
+  INT WakeUpType;
+
+  LOCK_CORE(Self);
+
+  TaskCurrent->Sleeping = TRUE;
+  TaskCurrent->WakeUpType = 0;
+  if (Delay == 0) {
+    TaskCurrent->TimerFlag = TRUE;
+    TaskCurrent->Timer = 0;
+  } else if (Delay == MSG_WAIT) {
+    TaskCurrent->Timer = 0;
+  } else {
+    TaskCurrent->Timer = Delay;
+  }
+  MultiTask = TaskSwitchPermit;
+
+  K_HAL_ContextSwitch(&(TaskCurrent->StackPtr), OS_SP);
+
+  // A sleeping task can be stolen: it may wake up on another core, holding that
+  // core's lock
+  Self = CURRENT_CORE();
+  MultiTask = TRUE;
+  WakeUpType = TaskCurrent->WakeUpType;
+  UNLOCK_CORE(Self);
+  return WakeUpType;
+}
+
+// Advances the kernel clock. Called with interrupts disabled, or from the tick ISR.
+// On SMP builds it only runs in the ISR, which can take the locks without masking:
+// no lock is ever held on the tick core while its interrupts are enabled.
+static void AdvanceTime(WORD Ticks)
+{
+  struct TASK *Task;
+  struct CORE *C;
+#if TASK_BUDGETS
+  struct TASK *Overrun;
+  WORD OverrunTicks = 0;
+#endif
+
+  NEST(&KernelLock);
+  TickCount += Ticks;
+#if BYTE_STREAMS
+  StreamTick();
+#endif
+  UNNEST(&KernelLock);
+  for (C = Cores; C < Cores + SMP_CORES; C++) {
+    NEST_CORE(C);
+#if TASK_BUDGETS
+    Overrun = C->Running;
+    if (Overrun && Overrun->Budget && BudgetHook && !C->HookFired &&
+        (WORD)(TickCount - C->Start) > Overrun->Budget) {
+      C->HookFired = TRUE; // Report each overrunning dispatch once, not every tick
+      OverrunTicks = (WORD)(TickCount - C->Start);
+    } else {
+      Overrun = NULL;
+    }
+#endif
+    Task = C->Current;
+    if (!Task) { // Empty ring (or OS not running yet): nothing running either
+      UNNEST_CORE(C);
+      continue;
+    }
+    do {
+      if (Task->Timer) {
+        if (Task->Timer <= Ticks) {
+          Task->Timer = 0;
+          Task->TimerFlag = TRUE;
+#if EDF_SCHED
+          if (!Task->Sleeping) { Task->TimerDeadline = TickCount + Task->RelDeadline; }
+          EdfUpdate(Task);
+#endif
+        } else {
+          Task->Timer -= Ticks;
+        }
+      }
+#if EDF_SCHED
+      if (Task->Period) {
+        WORD Left = Ticks;
+        // A simulator jump can span several periods
+        while (Task->ReleaseTimer <= Left) {
+          Left -= Task->ReleaseTimer;
+          Task->ReleaseTimer = Task->Period;
+          ReleaseTask(Task, TickCount - Left);
+        }
+        Task->ReleaseTimer -= Left;
+      }
+#endif
+      Task = NEXT_TASK(Task);
+    } while (Task != C->Current);
+    UNNEST_CORE(C);
+#if TASK_BUDGETS
+    // Outside the lock, so the hook may send messages
+    if (Overrun) { BudgetHook(Overrun, OverrunTicks); }
+#endif
+  }
+}
+
+void key_timer_irq_handler()
+{
+  // Only one core takes the tick; AdvanceTime takes the locks it needs
+  AdvanceTime(1);
+}
+
+#if KDOS_CONSOLE
+// Introspection console
+// =====================
+// Commands are one line each: "t" lists every task, "q <id>" shows the messages
+// queued for a task, "c" prints the kernel counters and "h" the command list.
+// Nothing is formatted inside a critical section: each one only copies a single
+// TCB or message, so the console adds no more interrupt latency than SendMsg.
+
+// What "t" prints about one task
+struct CONSOLE_TASK
+{
+  struct TASK *Task;      // Only dereferenced under its core's lock while that ring's
+                          // Generation is the one the walk started with
+  BYTE TaskID;
+  char State;             // S in Sleep(), R ready, W waiting
+  bool Current;           // Its core's current task
+  bool TimerFlag;
+  WORD Timer;
+  WORD MsgCount;
+  WORD QueueCapacity;
+  BYTE Core;
+#if TASK_BUDGETS
+  WORD OverrunCount;
+#endif
+#if EDF_SCHED
+  WORD DeadlineMisses;
+#endif
+};
+
+// Position in a walk over every core's ring
+struct CONSOLE_WALK
+{
+  WORD Generation[SMP_CORES]; // Each ring's Generation when the walk started
+  BYTE Core;              // Core being walked
+  struct TASK *Start;
+  struct TASK *Next;      // NULL: start on the core's current task
+  bool Changed;           // A task was linked or unlinked: the walk was abandoned
+};
+
+static void ConsoleStr(const char *Str)
+{
+  while (*Str) { ConsolePut((BYTE)*Str++); }
+}
+
+static void ConsoleNum(LONG Value)
+{
+  char Digits[3 * sizeof(unsigned long) + 1]; // A byte holds under 3 decimal digits
+  BYTE Count = 0;
+  unsigned long Magnitude = (unsigned long)Value;
+
+  if (Value < 0) {
+    ConsolePut('-');
+    Magnitude = 0UL - Magnitude;
+  }
+  do {
+    Digits[Count++] = (char)('0' + Magnitude % 10);
+    Magnitude /= 10;
+  } while (Magnitude);
+  while (Count) { ConsolePut((BYTE)Digits[--Count]); }
+}
+
+// Prints " Name=Value"
+static void ConsoleField(const char *Name, LONG Value)
+{
+  ConsolePut(' ');
+  ConsoleStr(Name);
+  ConsolePut('=');
+  ConsoleNum(Value);
+}
+
+static void ConsoleStartWalk(struct CONSOLE_WALK *Walk)
+{
+  struct CORE *C;
+
+  for (C = Cores; C < Cores + SMP_CORES; C++) {
+    LOCK_CORE(C);
+    Walk->Generation[C - Cores] = C->Generation;
+    UNLOCK_CORE(C);
+  }
+  Walk->Core = 0;
+  Walk->Start = NULL;
+  Walk->Next = NULL;
+  Walk->Changed = FALSE;
+}
+
+// Copies the next task of the walk into Snap, under its core's lock. The rings
+// may change between calls; a ring's links are only followed while its Generation
+// says it has not. Returns FALSE when the walk is over.
+static bool ConsoleNextTask(struct CONSOLE_WALK *Walk, struct CONSOLE_TASK *Snap)
+{
+  struct CORE *C;
+  struct TASK *Task;
+
+  for (;;) {
+    if (Walk->Core >= SMP_CORES) { return FALSE; }
+    C = &Cores[Walk->Core];
+    LOCK_CORE(C);
+    if (C->Generation != Walk->Generation[Walk->Core]) {
+      Walk->Changed = TRUE;
+      UNLOCK_CORE(C);
+      return FALSE;
+    }
+    if (Walk->Next == NULL) { Walk->Start = Walk->Next = C->Current; }
+    if (Walk->Next != NULL) { break; }
+    UNLOCK_CORE(C); // Empty ring
+    ++Walk->Core;
+  }
+  Task = Walk->Next;
+  Snap->Task = Task;
+  Snap->TaskID = Task->TaskID;
+  Snap->State = Task->Sleeping ? 'S' : (TaskReady(Task) ? 'R' : 'W');
+  Snap->Core = Walk->Core;
+  Snap->Current = (Task == C->Current);
+  Snap->TimerFlag = Task->TimerFlag;
+  Snap->Timer = Task->Timer;
+  Snap->MsgCount = Task->MsgCount;
+  Snap->QueueCapacity = Task->QueueCapacity;
+#if TASK_BUDGETS
+  Snap->OverrunCount = Task->OverrunCount;
+#endif
+#if EDF_SCHED
+  Snap->DeadlineMisses = Task->DeadlineMisses;
+#endif
+  Walk->Next = NEXT_TASK(Task);
+  if (Walk->Next == Walk->Start) {
+    Walk->Next = NULL;
+    ++Walk->Core;
+  }
+  UNLOCK_CORE(C);
+  return TRUE;
+}
+
+static void ConsoleWalkEnd(struct CONSOLE_WALK *Walk)
+{
+  if (Walk->Changed) { ConsoleStr("~ tasks changed, retry\r\n"); }
+}
+
+static void ConsoleTasks(void)
+{
+  struct CONSOLE_WALK Walk;
+  struct CONSOLE_TASK Snap;
+
+  ConsoleStartWalk(&Walk);
+  while (ConsoleNextTask(&Walk, &Snap)) {
+    ConsolePut(Snap.TaskID);
+    ConsolePut(' ');
+    ConsolePut((BYTE)Snap.State);
+    ConsolePut(Snap.Current ? '*' : ' ');
+    ConsoleField("timer", Snap.Timer);
+    ConsoleField("flag", Snap.TimerFlag);
+    ConsoleField("q", Snap.MsgCount);
+    ConsolePut('/');
+    ConsoleNum(Snap.QueueCapacity);
+#if SMP_CORES > 1
+    ConsoleField("core", Snap.Core);
+#endif
+#if TASK_BUDGETS
+    ConsoleField("overruns", Snap.OverrunCount);
+#endif
+#if EDF_SCHED
+    ConsoleField("misses", Snap.DeadlineMisses);
+#endif
+    ConsoleStr("\r\n");
+  }
+  ConsoleWalkEnd(&Walk);
+}
+
+// Copy of the message Index places behind the oldest one. The lock of Task's core
+// must be held.
+static struct MSG QueuedMsg(struct TASK *Task, WORD Index)
+{
+#if COMPACT_TCB
+  return Task->MsgQueue[(Task->MsgQueueOut + Index) % Task->QueueCapacity];
+#else
+  return Task->MsgQueue[((Task->MsgQueueOut - Task->MsgQueue) + Index) % Task->QueueCapacity];
+#endif
+}
+
+static void ConsoleQueue(BYTE TaskID)
+{
+  struct CONSOLE_WALK Walk;
+  struct CONSOLE_TASK Snap;
+  struct CORE *C;
+  struct MSG Msg;
+  WORD Index;
+
+  ConsoleStartWalk(&Walk);
+  Snap.TaskID = 0;
+  while (ConsoleNextTask(&Walk, &Snap) && Snap.TaskID != TaskID) {}
+  if (Walk.Changed) {
+    ConsoleWalkEnd(&Walk);
+    return;
+  }
+  if (Snap.TaskID != TaskID) {
+    ConsoleStr("? no such task\r\n");
+    return;
+  }
+  // One message per critical section, counted from whichever is oldest at the time
+  C = &Cores[Snap.Core];
+  for (Index = 0; ; Index++) {
+    LOCK_CORE(C);
+    Walk.Changed = (C->Generation != Walk.Generation[Snap.Core]);
+    if (Walk.Changed || Index >= Snap.Task->MsgCount) {
+      UNLOCK_CORE(C);
+      break;
+    }
+    Msg = QueuedMsg(Snap.Task, Index);
+    UNLOCK_CORE(C);
+    ConsoleNum(Index);
+    ConsoleField("type", Msg.MsgType);
+    ConsoleField("s", Msg.sParam);
+    ConsoleField("l", Msg.lParam);
+#if EDF_SCHED
+    ConsoleField("due", Msg.Deadline);
+#endif
+    ConsoleStr("\r\n");
+  }
+  if (Index == 0 && !Walk.Changed) { ConsoleStr("empty\r\n"); }
+  ConsoleWalkEnd(&Walk);
+}
+
+static void ConsoleCounters(void)
+{
+  LONG Dispatches = 0;
+  WORD Generation = 0;
+  int Tasks = 0;
+  struct CORE *C;
+#if TASK_BUDGETS
+  struct OVERRUN Overrun;
+#endif
+
+  for (C = Cores; C < Cores + SMP_CORES; C++) {
+    LOCK_CORE(C);
+    Dispatches += C->Dispatches;
+    Generation += C->Generation;
+    Tasks += C->Count;
+    UNLOCK_CORE(C);
+  }
+
+  ConsoleStr("ticks=");
+  ConsoleNum(GetTicks());
+  ConsoleField("tasks", Tasks);
+  ConsoleField("dispatches", Dispatches);
+  ConsoleField("ring_changes", Generation);
+#if TASK_BUDGETS
+  if (GetLastOverrun(&Overrun)) {
+    ConsoleStr(" last_overrun=");
+    ConsolePut(Overrun.TaskID);
+    ConsolePut('/');
+    ConsoleNum(Overrun.Ticks);
+  }
+#endif
+  ConsoleStr("\r\n");
+}
+
+static void ConsoleCommand(void)
+{
+  BYTE Arg = 0;
+  BYTE i;
+
+  for (i = 1; i < ConsoleLen; i++) {
+    if (ConsoleLine[i] != ' ') {
+      Arg = (BYTE)ConsoleLine[i];
+      break;
+    }
+  }
+  switch (ConsoleLine[0]) {
+    case 't': ConsoleTasks(); break;
+    case 'q':
+      if (Arg) { ConsoleQueue(Arg); }
+      else { ConsoleStr("? q <task id>\r\n"); }
+      break;
+    case 'c': ConsoleCounters(); break;
+    case 'h':
+    case '?':
+      ConsoleStr("t tasks | q <id> queue | c counters | h help\r\n");
+      break;
+    default:
+      ConsoleStr("? h for help\r\n");
+      break;
+  }
+}
+
+// The console task only ever hears from its stream, so every message means input
+static WORD ConsoleTask(WORD MsgType, WORD sParam, LONG lParam)
+{
+  BYTE Input[8];
+  WORD Count;
+  WORD i;
+
+  (void)MsgType;
+  (void)sParam;
+  (void)lParam;
+  while ((Count = StreamRead(ConsoleIn, Input, sizeof(Input))) != 0) {
+    for (i = 0; i < Count; i++) {
+      if (Input[i] == '\r' || Input[i] == '\n') {
+        if (ConsoleLen) { ConsoleCommand(); }
+        ConsoleLen = 0;
+      } else if (ConsoleLen < sizeof(ConsoleLine)) {
+        ConsoleLine[ConsoleLen++] = (char)Input[i];
+      }
+    }
+  }
+  return MSG_WAIT;
+}
+
+struct STREAM *InitConsole(void (*Put)(BYTE Byte))
+{
+  struct TASK *Task;
+
+  ConsolePut = Put;
+  Task = InitTask(ConsoleTask, CONSOLE_STACK_SIZE, 2, CONSOLE_TASK_ID);
+#if EDF_SCHED
+  if (Task == NULL) { return NULL; } // MAX_TASKS reached
+  SetTaskPeriod(Task, 0, 0xffff); // Served after anything with a real deadline
+#endif
+  ConsoleIn = InitStream(32, Task, MSG_TYPE_INIT, 1, 0);
+  return ConsoleIn;
+}
+#endif
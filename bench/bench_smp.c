@@ -0,0 +1,73 @@
+// SMP scaling: tokens passed around a ring of tasks, each hop a SendMsg to the
+// next task, on the real SIGALRM clock. Built once per core count (bench_smp1,
+// bench_smp2, ...); each run measures one second without work per hop and one
+// second with a busy loop per hop, then prints hops per second.
+#include "../tests/ktest.h"
+
+#define RING   16
+#define TOKENS 8
+#define WORK   20000
+
+static struct TASK *Ring[RING];
+static volatile long Hops[RING];
+static volatile int Work;
+
+static WORD Hop(WORD MsgType, WORD sParam, LONG lParam)
+{
+    volatile int x = 0;
+    int i;
+    (void)lParam;
+    if (MsgType == 5) {
+        for (i = 0; i < Work; i++) { x += i; }
+        ++Hops[sParam];
+        SendMsg(Ring[(sParam + 1) % RING], 5, (WORD)((sParam + 1) % RING), 0);
+    }
+    return MSG_WAIT;
+}
+
+static long TakeHops(void)
+{
+    long Total = 0;
+    int i;
+    for (i = 0; i < RING; i++) {
+        Total += Hops[i];
+        Hops[i] = 0;
+    }
+    return Total;
+}
+
+// Pinned to core 0 so it is never stuck behind a stolen hop
+static WORD Clock(WORD MsgType, WORD sParam, LONG lParam)
+{
+    static long Idle;
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == MSG_TYPE_INIT) {
+        TakeHops();
+        return 1000;
+    }
+    if (Work == 0) {
+        Idle = TakeHops();
+        Work = WORK;
+        return 1000;
+    }
+    printf("cores=%d  hops/s: %ld without work, %ld with %d-iteration work\n",
+           SMP_CORES, Idle, TakeHops(), WORK);
+    exit(0);
+}
+
+int main(void)
+{
+    struct TASK *t;
+    int i;
+
+    for (i = 0; i < RING; i++) { Ring[i] = InitTask(Hop, 16384, TOKENS, 'a' + i); }
+    t = InitTask(Clock, 16384, 2, 'C');
+#if SMP_CORES > 1
+    SetTaskAffinity(t, 0);
+#endif
+    SendMsg(t, MSG_TYPE_INIT, 0, 0);
+    for (i = 0; i < RING; i += RING / TOKENS) { SendMsg(Ring[i], 5, (WORD)i, 0); }
+    RunOS();
+    return 1;
+}
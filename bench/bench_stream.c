@@ -0,0 +1,114 @@
+// Byte stream throughput: a writer fills a 4 KB stream in chunks of 1 to 1024
+// bytes and the reader drains it when notified, once with StreamWrite/StreamRead
+// copies and once through the zero-copy region calls. Reports MB/s of wall time
+// and the critical sections each side enters per 1000 commits. Runs on the real
+// SIGALRM clock, so those mask the tick as on target (counted by the host BSP in
+// HostMaskCount); the idle timeout is on, so the writer stamps every commit.
+#include "../tests/ktest.h"
+#include "../templates/host/host_bsp.h"
+#include <string.h>
+#include <time.h>
+
+#define STREAM_SIZE 4096
+#define TOTAL       (64L * 1024 * 1024)
+
+static struct STREAM *S;
+static WORD Chunk = 1;
+static bool ZeroCopy;
+static long Written, Read;
+static long Writes, Reads;
+static unsigned long WriteMasks, ReadMasks;
+static BYTE Src[1024], Dst[1024];
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Writes TOTAL bytes per mode and chunk size, yielding while the stream is full,
+// then waits for the reader to catch up and moves on to the next run
+static WORD Writer(WORD MsgType, WORD sParam, LONG lParam)
+{
+    static double Start;
+    static double Mbs[2];
+    unsigned long m0;
+    BYTE *region;
+    WORD n;
+    (void)sParam;
+    (void)lParam;
+
+    if (MsgType == MSG_TYPE_INIT) {
+        printf("chunk  copy MB/s  region MB/s  write masks/1k  read masks/1k\n");
+        Start = Now();
+    }
+    while (Written < TOTAL) {
+        m0 = HostMaskCount;
+        if (ZeroCopy) {
+            n = StreamWriteRegion(S, &region);
+            if (n > Chunk) { n = Chunk; }
+            memcpy(region, Src, n); // Stands in for the producer generating in place
+            StreamCommitWrite(S, n);
+        } else {
+            n = StreamWrite(S, Src, Chunk);
+        }
+        WriteMasks += HostMaskCount - m0;
+        if (n == 0) { return 0; } // Full: let the reader run
+        Written += n;
+        ++Writes;
+    }
+    if (Read < TOTAL) { return 0; } // The tail below the trigger waits for the idle timeout
+
+    Mbs[ZeroCopy] = TOTAL / 1048576.0 / (Now() - Start);
+    if (ZeroCopy) {
+        printf("%5u %10.1f %12.1f %15.2f %14.2f\n", Chunk, Mbs[0], Mbs[1],
+               WriteMasks * 1000.0 / Writes, ReadMasks * 1000.0 / Reads);
+        WriteMasks = ReadMasks = 0;
+        Writes = Reads = 0;
+        Chunk *= 4;
+        if (Chunk > 1024) { exit(0); }
+    }
+    ZeroCopy = !ZeroCopy;
+    Written = Read = 0;
+    Start = Now();
+    return 0;
+}
+
+static WORD Reader(WORD MsgType, WORD sParam, LONG lParam)
+{
+    unsigned long m0;
+    BYTE *region;
+    WORD n;
+    (void)sParam;
+    (void)lParam;
+
+    // One read per message: the commit asks for another dispatch while a full
+    // batch is left
+    if (MsgType == 40) {
+        m0 = HostMaskCount;
+        if (ZeroCopy) {
+            n = StreamReadRegion(S, &region);
+            if (n) { Dst[0] ^= region[0]; } // Touch the data where it lies
+            StreamCommitRead(S, n);
+        } else {
+            n = StreamRead(S, Dst, sizeof(Dst));
+        }
+        ReadMasks += HostMaskCount - m0;
+        Read += n;
+        ++Reads;
+    }
+    return MSG_WAIT;
+}
+
+int main(void)
+{
+    struct TASK *w, *r;
+
+    r = InitTask(Reader, 2048, 4, 'R');
+    w = InitTask(Writer, 2048, 4, 'W');
+    S = InitStream(STREAM_SIZE, r, 40, STREAM_SIZE / 4, 1);
+    SendMsg(w, MSG_TYPE_INIT, 0, 0);
+    RunOS();
+    return 1;
+}
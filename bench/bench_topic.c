@@ -0,0 +1,101 @@
+// Topic fan-out: the cost of one Publish() to N subscribers against N SendMsg()
+// calls, per delivered message, and the critical sections each fan-out enters.
+// Runs on the real SIGALRM clock, so every critical section masks the tick the
+// way it would on target; the host BSP counts those masks (HostMaskCount). Only the
+// sending side is timed; the producer yields after each fan-out, so the
+// subscribers drain their queues between rounds.
+#include "../tests/ktest.h"
+#include "../templates/host/host_bsp.h"
+#include <time.h>
+
+#define MAX_SUBS 32
+#define ROUNDS   20000L
+
+static struct TASK *Subs[MAX_SUBS];
+static struct TOPIC *Topic;
+static BYTE Fanout = 1;
+static int Mode;          // 0 Publish, 1 SendMsg
+static long Received;
+static long Left = ROUNDS;
+static unsigned long Masks;
+static double Elapsed;
+static double Ns[2];
+static double PerRound[2];
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static WORD Subscriber(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == 20) { ++Received; }
+    return MSG_WAIT;
+}
+
+// Subscribes the first Fanout tasks to a fresh topic
+static void NewTopic(void)
+{
+    BYTE i;
+    Topic = InitTopic(Fanout);
+    for (i = 0; i < Fanout; i++) { Subscribe(Topic, Subs[i]); }
+}
+
+// One fan-out per dispatch, then a yield; moves to the next mode and fan-out
+// after ROUNDS of them
+static WORD Producer(WORD MsgType, WORD sParam, LONG lParam)
+{
+    unsigned long m0;
+    double t0;
+    BYTE i;
+    (void)sParam;
+    (void)lParam;
+
+    if (MsgType == MSG_TYPE_INIT) {
+        printf("subscribers  Publish ns/msg  masks/publish  SendMsg ns/msg  masks/fan-out\n");
+        NewTopic();
+        return 0;
+    }
+    m0 = HostMaskCount;
+    t0 = Now();
+    if (Mode == 0) {
+        Publish(Topic, 20, 0, 0);
+    } else {
+        for (i = 0; i < Fanout; i++) { SendMsg(Subs[i], 20, 0, 0); }
+    }
+    Elapsed += Now() - t0;
+    Masks += HostMaskCount - m0;
+    if (--Left) { return 0; }
+
+    Sleep(1, TASK_SWITCH_PERMIT); // Let the last round drain
+    Ns[Mode] = Elapsed * 1e9 / Received;
+    PerRound[Mode] = (double)Masks / ROUNDS;
+    Elapsed = 0;
+    Received = 0;
+    Masks = 0;
+    Left = ROUNDS;
+    if (++Mode < 2) { return 0; }
+
+    printf("%11u %15.1f %14.2f %15.1f %14.2f\n", Fanout, Ns[0], PerRound[0], Ns[1], PerRound[1]);
+    Mode = 0;
+    Fanout *= 2;
+    if (Fanout > MAX_SUBS) { exit(0); }
+    NewTopic();
+    return 0;
+}
+
+int main(void)
+{
+    struct TASK *p;
+    BYTE i;
+
+    for (i = 0; i < MAX_SUBS; i++) { Subs[i] = InitTask(Subscriber, 2048, 4, 'a' + i); }
+    p = InitTask(Producer, 2048, 4, 'P');
+    SendMsg(p, MSG_TYPE_INIT, 0, 0);
+    RunOS();
+    return 1;
+}
@@ -0,0 +1,183 @@
+// Cost of a task switch through the Cortex-M port (templates/stm32f4/bsp.c) on the
+// MPS2 AN386 (Cortex-M4F), on the board or under QEMU's mps2-an386. Two tasks hand
+// the CPU back and forth with Sleep(0): each yield is two PendSV switches (task to
+// scheduler and back to the other task) and one scheduler pass. The pairing is run
+// integer/integer, FPU/integer and FPU/FPU; an FPU task does one float multiply-add
+// per yield where an integer task does an integer one, so the difference is what
+// saving s16-s31 and the lazily stacked s0-s15 costs.
+#include "kmulti.h"
+#include "kdos.h"
+#include "stm32f4xx.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define YIELDS 20000L
+
+#define MSG_RUN  20 // sParam: uses the FPU, lParam: yields
+#define MSG_DONE 21
+
+// CMSDK APB timer 1 and UART 0 of the MPS2 FPGA image, both on the 25 MHz core clock
+#define TIMER1_CTRL   (*(volatile uint32_t *)0x40001000UL)
+#define TIMER1_VALUE  (*(volatile uint32_t *)0x40001004UL)
+#define TIMER1_RELOAD (*(volatile uint32_t *)0x40001008UL)
+#define UART0_DATA    (*(volatile uint32_t *)0x40004000UL)
+#define UART0_STATE   (*(volatile uint32_t *)0x40004004UL)
+#define UART0_CTRL    (*(volatile uint32_t *)0x40004008UL)
+#define UART0_BAUDDIV (*(volatile uint32_t *)0x40004010UL)
+
+uint32_t SystemCoreClock = 25000000UL;
+
+static const struct
+{
+    const char *Name;
+    bool Fpu[2];
+} Phases[] = {
+    { "integer / integer", { FALSE, FALSE } },
+    { "FPU / integer",     { TRUE,  FALSE } },
+    { "FPU / FPU",         { TRUE,  TRUE } },
+};
+
+static struct TASK *Workers[2];
+static struct TASK *Driver;
+
+// Timer 1 counts down from 0xFFFFFFFF, one tick per core clock
+static uint32_t Now(void)
+{
+    return ~TIMER1_VALUE;
+}
+
+static WORD Worker(WORD MsgType, WORD sParam, LONG lParam)
+{
+    volatile uint32_t Acc = 1;
+    volatile float FAcc = 1.0f;
+    LONG i;
+
+    if (MsgType != MSG_RUN) { return MSG_WAIT; }
+    for (i = 0; i < lParam; i++) {
+        if (sParam) {
+            FAcc = FAcc * 0.5f + 1.0f;
+        } else {
+            Acc = Acc * 3 + 1;
+        }
+        Sleep(0, TASK_SWITCH_PERMIT);
+    }
+    SendMsg(Driver, MSG_DONE, 0, 0);
+    return MSG_WAIT;
+}
+
+static WORD Drive(WORD MsgType, WORD sParam, LONG lParam)
+{
+    static BYTE Phase;
+    static BYTE Done;
+    static uint32_t Start;
+    uint32_t Ticks;
+    (void)sParam;
+    (void)lParam;
+
+    if (MsgType == MSG_DONE) {
+        if (++Done < 2) { return MSG_WAIT; }
+        Ticks = Now() - Start;
+        printf("%-20s %10lu %8lu.%02lu\n", Phases[Phase].Name, (unsigned long)Ticks,
+               (unsigned long)(Ticks / (2 * YIELDS)),
+               (unsigned long)(Ticks % (2 * YIELDS) * 100 / (2 * YIELDS)));
+        ++Phase;
+    } else if (MsgType != MSG_TYPE_INIT) {
+        return MSG_WAIT;
+    } else {
+        printf("pairing                   ticks    per yield\n");
+    }
+    if (Phase == sizeof Phases / sizeof Phases[0]) { exit(0); }
+    Done = 0;
+    Start = Now();
+    SendMsg(Workers[0], MSG_RUN, Phases[Phase].Fpu[0], YIELDS);
+    SendMsg(Workers[1], MSG_RUN, Phases[Phase].Fpu[1], YIELDS);
+    return MSG_WAIT;
+}
+
+void Emergency(const char *Msg)
+{
+    printf("EMERGENCY: %s\n", Msg);
+    exit(2);
+}
+
+void DebugPrintf(const char *Format, ...)
+{
+    (void)Format;
+}
+
+int main(void)
+{
+    UART0_BAUDDIV = 25000000UL / 115200UL;
+    UART0_CTRL = 1; // TX enable
+    TIMER1_RELOAD = 0xFFFFFFFFUL;
+    TIMER1_VALUE = 0xFFFFFFFFUL;
+    TIMER1_CTRL = 1;
+
+    Workers[0] = InitTask(Worker, 256, 2, 'A');
+    Workers[1] = InitTask(Worker, 256, 2, 'B');
+    Driver = InitTask(Drive, 256, 4, 'D');
+    SendMsg(Driver, MSG_TYPE_INIT, 0, 0);
+    RunOS();
+    return 0;
+}
+
+// Bare-metal plumbing: newlib output to UART 0, exit through semihosting (QEMU
+// -semihosting, or a debugger on the board), vector table and reset
+int _write(int File, const char *Buf, int Len)
+{
+    int i;
+    (void)File;
+    for (i = 0; i < Len; i++) {
+        while (UART0_STATE & 1) {} // TX full
+        UART0_DATA = (uint8_t)Buf[i];
+    }
+    return Len;
+}
+
+void _exit(int Status)
+{
+    register uint32_t Op __asm("r0") = 0x18;                              // SYS_EXIT
+    register uint32_t Reason __asm("r1") = Status ? 0x20023UL : 0x20026UL; // Error / ApplicationExit
+    for (;;) {
+        __asm volatile ("bkpt 0xab" : : "r" (Op), "r" (Reason) : "memory");
+    }
+}
+
+static void Fault(void)
+{
+    _exit(3);
+}
+
+void Reset_Handler(void);
+void PendSV_Handler(void);
+void SysTick_Handler(void);
+
+extern uint32_t __stack_top, __bss_start__, __bss_end__;
+
+__attribute__((section(".vectors"), used))
+static void (*const Vectors[16])(void) = {
+    (void (*)(void))&__stack_top,
+    Reset_Handler,
+    Fault,          // NMI
+    Fault,          // HardFault
+    Fault,          // MemManage
+    Fault,          // BusFault
+    Fault,          // UsageFault
+    0, 0, 0, 0,
+    Fault,          // SVCall
+    Fault,          // Debug monitor
+    0,
+    PendSV_Handler,
+    SysTick_Handler,
+};
+
+void Reset_Handler(void)
+{
+    uint32_t *p;
+
+    SCB->CPACR |= 0xFUL << 20; // Full access to CP10/CP11 (the FPU)
+    __DSB();
+    __ISB();
+    for (p = &__bss_start__; p < &__bss_end__; p++) { *p = 0; }
+    exit(main());
+}
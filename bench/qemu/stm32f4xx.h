@@ -0,0 +1,81 @@
+// Stands in for the vendor device header when templates/stm32f4/bsp.c is built for
+// the MPS2 AN386 FPGA image, a plain Cortex-M4F: only the core registers and
+// intrinsics the BSP uses, so the benchmark needs nothing beyond arm-none-eabi-gcc.
+#ifndef STM32F4XX_H_INCLUDED
+#define STM32F4XX_H_INCLUDED
+
+#include <stdint.h>
+
+#define __NVIC_PRIO_BITS 3
+#if defined(__VFP_FP__) && !defined(__SOFTFP__)
+#define __FPU_USED 1
+#else
+#define __FPU_USED 0
+#endif
+
+typedef enum
+{
+    PendSV_IRQn = -2,
+    SysTick_IRQn = -1
+} IRQn_Type;
+
+typedef struct
+{
+    volatile uint32_t CPUID, ICSR, VTOR, AIRCR, SCR, CCR;
+    volatile uint8_t SHP[12]; // System handler priorities, exceptions 4-15
+    volatile uint32_t SHCSR, CFSR, HFSR, DFSR, MMFAR, BFAR, AFSR;
+    const volatile uint32_t PFR[2], DFR, ADR, MMFR[4], ISAR[5];
+    uint32_t RESERVED0[5];
+    volatile uint32_t CPACR;
+} SCB_Type;
+
+typedef struct
+{
+    volatile uint32_t CTRL, LOAD, VAL;
+    const volatile uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct
+{
+    uint32_t RESERVED0;
+    volatile uint32_t FPCCR, FPCAR, FPDSCR;
+} FPU_Type;
+
+#define SCB     ((SCB_Type *)0xE000ED00UL)
+#define SysTick ((SysTick_Type *)0xE000E010UL)
+#define FPU     ((FPU_Type *)0xE000EF30UL)
+
+#define SCB_ICSR_PENDSVSET_Msk (1UL << 28)
+#define FPU_FPCCR_ASPEN_Msk    (1UL << 31)
+#define FPU_FPCCR_LSPEN_Msk    (1UL << 30)
+
+extern uint32_t SystemCoreClock;
+
+static inline void __disable_irq(void) { __asm volatile ("cpsid i" ::: "memory"); }
+static inline void __enable_irq(void)  { __asm volatile ("cpsie i" ::: "memory"); }
+static inline void __DSB(void)         { __asm volatile ("dsb 0xF" ::: "memory"); }
+static inline void __ISB(void)         { __asm volatile ("isb 0xF" ::: "memory"); }
+
+static inline uint32_t __get_IPSR(void)
+{
+    uint32_t ipsr;
+    __asm volatile ("mrs %0, ipsr" : "=r" (ipsr));
+    return ipsr;
+}
+
+// Only the system exceptions are used here
+static inline void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    SCB->SHP[((uint32_t)IRQn & 0xFUL) - 4UL] = (uint8_t)(priority << (8U - __NVIC_PRIO_BITS));
+}
+
+static inline uint32_t SysTick_Config(uint32_t ticks)
+{
+    SysTick->LOAD = ticks - 1UL;
+    NVIC_SetPriority(SysTick_IRQn, (1UL << __NVIC_PRIO_BITS) - 1UL);
+    SysTick->VAL = 0;
+    SysTick->CTRL = 7; // Core clock, interrupt, enable
+    return 0;
+}
+
+#endif // STM32F4XX_H_INCLUDED
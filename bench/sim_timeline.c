@@ -0,0 +1,47 @@
+// Example: a sensor task sampling every 100 ms and a logger it wakes, run for
+// two virtual seconds on the SIM_TIME clock; the dispatch timeline is printed
+// at the end. Output is the same on every run and every host.
+#include "../tests/ktest.h"
+
+static struct TASK *Logger;
+
+static WORD Sensor(WORD MsgType, WORD sParam, LONG lParam)
+{
+    static WORD Sample;
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+    SimConsume(3);
+    SendMsg(Logger, 10, Sample++, GetTicks());
+    return 100;
+}
+
+static WORD Log(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == 10) {
+        SimConsume(1);
+    }
+    return MSG_WAIT;
+}
+
+int main(void)
+{
+    struct SIM_EVENT ev[SIM_TIMELINE_SIZE];
+    WORD n, i;
+
+    struct TASK *s = InitTask(Sensor, 2048, 4, 'S');
+    Logger = InitTask(Log, 2048, 4, 'L');
+    SendMsg(s, MSG_TYPE_INIT, 0, 0);
+
+    SimRun(2000L);
+
+    n = SimTimeline(ev, SIM_TIMELINE_SIZE);
+    printf("%lu dispatches, last %u:\n", (unsigned long)SimDispatches(), n);
+    printf("  start  ticks task\n");
+    for (i = 0; i < n; i++) {
+        printf("%7ld %6ld    %c\n", (long)ev[i].Start, (long)ev[i].Ticks, ev[i].TaskID);
+    }
+    return 0;
+}
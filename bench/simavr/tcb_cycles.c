@@ -0,0 +1,142 @@
+// Size and speed of the two task layouts on an ATmega328P, built once with
+// COMPACT_TCB=0 and once with COMPACT_TCB=1 and run under simavr (see README.md).
+// Prints the TCB size, then the cycles for:
+//   yield    two tasks handing the CPU back and forth with Sleep(0)
+//   message  two tasks passing one message back and forth, each hop a SendMsg,
+//            a queue read and a fresh dispatch of the task function
+// Cycles come from Timer1 at clk/1, read around batches short enough for its
+// 16-bit count; the 1 kHz tick interrupt is included, the same for both layouts.
+#include "kmulti.h"
+#include "kdos.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATCH   25 // Rounds per Timer1 reading, well under 65536 cycles
+#define BATCHES 40
+#define OPS     (2L * BATCH * BATCHES)
+
+#define MSG_HOP 20
+
+static struct TASK *Yielders[2];
+static struct TASK *Hoppers[2];
+static struct TASK *Driver;
+static uint32_t Cycles;
+static uint16_t Mark;
+static BYTE Step;
+
+static void Lap(void)
+{
+    uint16_t Now = TCNT1;
+    Cycles += (uint16_t)(Now - Mark);
+    Mark = Now;
+}
+
+static int UartPut(char c, FILE *Stream)
+{
+    (void)Stream;
+    while (!(UCSR0A & (1 << UDRE0))) {}
+    UDR0 = (uint8_t)c;
+    return 0;
+}
+
+static FILE Uart = FDEV_SETUP_STREAM(UartPut, NULL, _FDEV_SETUP_WRITE);
+
+// simavr ends the run when the CPU sleeps with interrupts off
+static void Stop(void)
+{
+    cli();
+    sleep_enable();
+    sleep_cpu();
+}
+
+static void Report(const char *Name)
+{
+    printf("%-8s %8lu cycles  %5lu per op\n", Name, (unsigned long)Cycles,
+           (unsigned long)(Cycles / OPS));
+}
+
+// Both yield BATCH * BATCHES times; the first reads the timer every BATCH rounds
+static WORD Yielder(WORD MsgType, WORD sParam, LONG lParam)
+{
+    WORD i, j;
+    (void)lParam;
+    if (MsgType != MSG_TYPE_INIT) { return MSG_WAIT; }
+    for (j = 0; j < BATCHES; j++) {
+        if (sParam == 0) { Mark = TCNT1; }
+        for (i = 0; i < BATCH; i++) { Sleep(0, TASK_SWITCH_PERMIT); }
+        if (sParam == 0) { Lap(); }
+    }
+    if (sParam == 0) { SendMsg(Driver, MSG_TYPE_INIT, 0, 0); }
+    return MSG_WAIT;
+}
+
+// lParam counts the hops left, from OPS down to 0; the timer is read every BATCH hops
+static WORD Hopper(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    if (MsgType != MSG_HOP) { return MSG_WAIT; }
+    if (lParam % BATCH == 0 && lParam != OPS) { Lap(); }
+    if (lParam == 0) {
+        SendMsg(Driver, MSG_TYPE_INIT, 0, 0);
+    } else {
+        SendMsg(Hoppers[(lParam - 1) % 2], MSG_HOP, 0, lParam - 1);
+    }
+    return MSG_WAIT;
+}
+
+static WORD Drive(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType != MSG_TYPE_INIT) { return MSG_WAIT; }
+    switch (Step++) {
+    case 0:
+        printf("COMPACT_TCB=%d  struct TASK %u bytes\n", COMPACT_TCB, (unsigned)sizeof(struct TASK));
+        Cycles = 0;
+        SendMsg(Yielders[0], MSG_TYPE_INIT, 0, 0);
+        SendMsg(Yielders[1], MSG_TYPE_INIT, 1, 0);
+        break;
+    case 1:
+        Report("yield");
+        Cycles = 0;
+        Mark = TCNT1;
+        SendMsg(Hoppers[0], MSG_HOP, 0, OPS);
+        break;
+    default:
+        Report("message");
+        Stop();
+    }
+    return MSG_WAIT;
+}
+
+void Emergency(const char *Msg)
+{
+    printf("EMERGENCY: %s\n", Msg);
+    Stop();
+}
+
+void DebugPrintf(const char *Format, ...)
+{
+    (void)Format;
+}
+
+int main(void)
+{
+    UBRR0 = F_CPU / 16 / 38400 - 1;
+    UCSR0B = (1 << TXEN0);
+    stdout = &Uart;
+    TCCR1B = (1 << CS10); // Free-running at clk/1
+
+    // Stack sizes are in 32-bit words
+    Yielders[0] = InitTask(Yielder, 40, 2, 'Y');
+    Yielders[1] = InitTask(Yielder, 40, 2, 'y');
+    Hoppers[0] = InitTask(Hopper, 40, 2, 'H');
+    Hoppers[1] = InitTask(Hopper, 40, 2, 'h');
+    Driver = InitTask(Drive, 64, 2, 'D');
+    SendMsg(Driver, MSG_TYPE_INIT, 0, 0);
+    RunOS();
+    return 0;
+}
@@ -2,6 +2,7 @@
 // Board Support Package implementations for KDOS HAL
 
 #include "k_hal.h"
+#include <stddef.h>
 #include "kdos.h" // May be needed for WORD, LONG, TaskCurrent, OS_SP etc. if used in HAL impl.
                   // Or include a specific types header if you have one.
 
@@ -43,7 +44,7 @@ void K_HAL_EnableInterrupts(void)
 
 void *K_HAL_InitTaskStack(void *p_stack_base,
                           unsigned int stack_size_bytes,
-                          void (*task_func_addr)(WORD, WORD, LONG),
+                          WORD (*task_func_addr)(WORD, WORD, LONG),
                           void (*task_exit_handler_addr)(WORD),
                           WORD initial_msg_type,
                           WORD initial_sparam,
@@ -152,52 +153,23 @@ void K_HAL_ContextSwitch(void **p_current_task_sp_storage, void *next_task_sp_va
 
 void K_HAL_StartScheduler(void *first_task_stack_ptr)
 {
-    // TODO: Implement this to start the OS and the first task.
-    // This function does not return.
+    // TODO: Prepare the CPU for task switching. This function MUST return.
     //
-    // Steps:
-    // 1. Ensure interrupts are disabled (caller `RunOS` should ensure this, or do it here).
-    //    K_HAL_DisableInterrupts(); // If not already done by caller.
-    //
-    // 2. Get the current Stack Pointer. This SP belongs to the context that called RunOS
-    //    (e.g., main() after C runtime setup). This will be the initial OS/scheduler stack.
-    //    Store this value in the global `OS_SP` variable in `Kdos.c`.
-    //    You might need an assembly intrinsic or a small asm function to get the current SP.
-    //    `extern int32_t* OS_SP;` // (Need to ensure visibility if OS_SP is static in Kdos.c)
-    //    `OS_SP = (int32_t*) Your_Get_Current_SP_Function();`
-    //    (If OS_SP is static in Kdos.c, this HAL function might need to be in Kdos.c too,
-    //     or OS_SP needs to be made non-static or accessible via a setter function).
-    //     For now, assume OS_SP is globally accessible or passed to K_HAL_ContextSwitch.
-    //
-    // 3. Set the CPU's current Stack Pointer to `first_task_stack_ptr`.
-    //
-    // 4. Restore the full CPU context of the first task from its stack (which was
-    //    prepared by `K_HAL_InitTaskStack`). This includes setting the PC to the
-    //    task's entry point and PSR to an appropriate initial state (interrupts enabled).
-    //
-    // 5. This last step effectively "returns" or jumps into the first task.
-    //
-    // Example (Conceptual for ARM Cortex-M):
-    //   K_HAL_DisableInterrupts(); // Ensure they are off
-    //   void* main_stack_ptr;
-    //   __asm volatile ("mov %0, sp" : "=r"(main_stack_ptr)); // Get current SP (main's stack)
-    //   // somehow set the global OS_SP in Kdos.c to main_stack_ptr
-    //   // For example, if OS_SP is accessible:
-    //   // extern int32_t* OS_SP; // from Kdos.c
-    //   // OS_SP = main_stack_ptr;
-    //
-    //   __asm volatile ("msr psp, %0" : : "r" (first_task_stack_ptr)); // Set Process Stack Pointer
-    //   // Code to ensure CPU uses PSP for thread mode and to trigger return to thread mode using PSP.
-    //   // This often involves setting CONTROL register and using BX LR with a special LR value.
-    //   // Then, load R0-R3, R12, LR, PC, xPSR from first_task_stack_ptr and execute.
-    //   // This is complex and highly specific.
+    // RunOS() calls this once and then runs the KDOS scheduler loop (SwitchTask) on
+    // the stack it was called from (e.g. main()'s stack). The scheduler enters every
+    // task, including the first one, with K_HAL_ContextSwitch(&OS_SP, Task->StackPtr),
+    // so OS_SP is filled in by your context switch; nothing needs to be stored here.
+    //
+    // Typical work:
+    // 1. Select the stack pointer tasks will run on, if the CPU has more than one
+    //    (e.g. the Process Stack Pointer on ARM Cortex-M).
+    // 2. Set the priority of any exception used for context switching.
+    // 3. Anything else K_HAL_ContextSwitch relies on being initialised.
+    //
+    // `first_task_stack_ptr` is only provided for ports that need to inspect it;
+    // do not switch to it here.
 
     (void)first_task_stack_ptr;
-    // Emergency("K_HAL_StartScheduler: Not implemented for this BSP!");
-    // This function should loop indefinitely if the context switch part fails,
-    // as KDOS expects it not to return.
-    while (1)
-        ;
 }
 
 // --- System Timer ---
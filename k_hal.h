@@ -51,7 +51,7 @@ void K_HAL_EnableInterrupts(void);
  */
 void *K_HAL_InitTaskStack(void *p_stack_base,
                           unsigned int stack_size_bytes,
-                          void (*task_func_addr)(WORD, WORD, LONG),
+                          WORD (*task_func_addr)(WORD, WORD, LONG),
                           void (*task_exit_handler_addr)(WORD), // Now takes WORD
                           WORD initial_msg_type,
                           WORD initial_sparam,
@@ -78,15 +78,15 @@ void *K_HAL_InitTaskStack(void *p_stack_base,
 void K_HAL_ContextSwitch(void **p_current_task_sp_storage, void *next_task_sp_val);
 
 /**
- * @brief Starts the OS scheduler and the first task.
- * This function is called once by RunOS(). It should:
- * 1. Save the current stack pointer (e.g., from main()) into the OS's global SP variable (e.g., OS_SP).
- * 2. Initiate a context switch to the first_task_stack_ptr.
- * This function does not return. Interrupts should be disabled by the caller before this call,
- * and the HAL implementation will enable them after starting the first task if appropriate.
+ * @brief Prepares the CPU for task switching.
+ * This function is called once by RunOS(), with interrupts enabled or disabled as
+ * left by main(), and MUST return. KDOS then runs its scheduler loop on the calling
+ * (main) stack; the first task, like every other, is entered through
+ * K_HAL_ContextSwitch(&OS_SP, ...), which is what saves the scheduler's context.
+ * Typical work: select the stack pointer tasks will use, set exception priorities.
  *
- * @param first_task_stack_ptr The initial stack pointer of the first task to run (from K_HAL_InitTaskStack).
- *                             The global OS_SP variable should be set up by this function.
+ * @param first_task_stack_ptr The initial stack pointer of the first task to run (from K_HAL_InitTaskStack),
+ *                             for ports that need to inspect it. It must not be switched to here.
  * Must be implemented by the BSP.
  */
 void K_HAL_StartScheduler(void *first_task_stack_ptr);
@@ -103,6 +103,55 @@ void K_HAL_StartScheduler(void *first_task_stack_ptr);
  */
 void K_HAL_InitSystemTimer(void (*timer_isr_addr)(void));
 
+// --- Multi-core (only needed when SMP_CORES > 1) ---
+
+#if SMP_CORES > 1
+/**
+ * @brief Returns the index (0 .. SMP_CORES-1) of the core executing the call.
+ * KDOS looks it up once per kernel call (and again after a task resumes, as tasks
+ * migrate), so a register or memory read is plenty (e.g. the SIO CPUID register
+ * on RP2040).
+ * Must be implemented by the BSP.
+ */
+BYTE K_HAL_CoreID(void);
+
+/**
+ * @brief Spins until *lock is acquired (e.g. an atomic exchange or LDREX/STREX
+ * loop, or a hardware spinlock), with acquire ordering. Must not touch interrupts:
+ * KDOS masks them itself around the outermost lock. Locks are not recursive.
+ * While spinning, back off (WFE, or yield on a hosted OS) rather than hammer the
+ * lock: the owner may have been preempted.
+ * Must be implemented by the BSP.
+ */
+void K_HAL_SpinLock(volatile INT *lock);
+
+/**
+ * @brief Releases *lock with release ordering, so writes made under it are visible
+ * to the next owner, and wakes cores waiting in K_HAL_SpinLock or K_HAL_CoreIdle
+ * (SEV on ARM).
+ * Must be implemented by the BSP.
+ */
+void K_HAL_SpinUnlock(volatile INT *lock);
+
+/**
+ * @brief Called by a core's scheduler, with no lock held and interrupts enabled,
+ * after a whole round found nothing to run here or to steal. Should wait for the
+ * next event or interrupt (WFE) or give the CPU away (sched_yield on a hosted OS);
+ * returning at once is correct but burns the core and the other cores' locks.
+ * Must be implemented by the BSP.
+ */
+void K_HAL_CoreIdle(void);
+
+/**
+ * @brief Starts cores 1 .. SMP_CORES-1, each calling core_main on its own stack.
+ * Called once by RunOS() on core 0, which then calls core_main itself. Only
+ * core 0 should take the system timer interrupt. core_main does not return.
+ * K_HAL_ContextSwitch must track the running context per core.
+ * Must be implemented by the BSP.
+ */
+void K_HAL_StartCores(void (*core_main)(void));
+#endif
+
 /**
  * @brief Optional: A macro to wrap architecture-specific ISR declaration attributes/pragmas.
  * Example for ARM GCC: #define K_HAL_ISR_FUNCTION_ATTRIBUTE __attribute__((interrupt("IRQ")))
@@ -17,6 +17,16 @@
 
 #define MSG_WAIT 0xffff
 
+// Optional kernel features. Override these on the compiler command line or
+// before including this file; every translation unit must see the same values
+// because they change the layout of struct TASK.
+
+// Set TASK_BUDGETS to 1 to time every dispatch against a per-task budget (in
+// ticks) and record the tasks that overrun it. Costs a few words per task.
+#ifndef TASK_BUDGETS
+#define TASK_BUDGETS 0
+#endif
+
 // Message identifiers
 
 enum MSG_TYPE
@@ -28,14 +38,172 @@ enum MSG_TYPE
   // Config program uses the next 2
 };
 
+// Set SIM_TIME to 1 for host simulation. The system timer is not started: the
+// clock only moves when every task is idle (it then jumps straight to the next
+// timer expiry) or when a task calls SimConsume(). SimRun() drives the scheduler
+// for a given span of virtual time and returns, so a test script can interleave
+// SendMsg() calls with runs and read back the dispatch timeline.
+#ifndef SIM_TIME
+#define SIM_TIME 0
+#endif
+
+// Dispatches kept for SimTimeline()
+#ifndef SIM_TIMELINE_SIZE
+#define SIM_TIMELINE_SIZE 64
+#endif
+
+// Set MSG_TOPICS to 1 for publish/subscribe topics: Publish() delivers one message
+// to every subscribed task in a single critical section.
+#ifndef MSG_TOPICS
+#define MSG_TOPICS 0
+#endif
+
+// Set BYTE_STREAMS to 1 for byte stream buffers: a single-writer/single-reader
+// byte ring (e.g. UART ISR to task) whose reader gets one message per batch of
+// Trigger bytes, or after IdleTimeout ticks without new data.
+#ifndef BYTE_STREAMS
+#define BYTE_STREAMS 0
+#endif
+
+// Number of cores KDOS schedules on. Above 1 each core runs its own scheduler over
+// its own ring of tasks, idle cores steal ready tasks from the others, and the BSP
+// must provide the SMP part of k_hal.h.
+#ifndef SMP_CORES
+#define SMP_CORES 1
+#endif
+
+#if SMP_CORES > 1 && SIM_TIME
+#error "SIM_TIME runs on a single core"
+#endif
+
+#define TASK_ANY_CORE 0xff
+
+// Number of distinct (stack size, queue size) pairs whose memory is kept for reuse
+// after DeleteTask. Deleted tasks of any other size are returned to the heap.
+#ifndef TASK_POOL_CLASSES
+#define TASK_POOL_CLASSES 4
+#endif
+
+// Set COMPACT_TCB to 1 on 8-bit targets to shrink struct TASK: tasks come from a
+// static table of MAX_TASKS entries linked by 8-bit index, each queue is a base
+// pointer plus 8-bit in/out/count (so at most 255 messages), and the flags share
+// one byte. Wake-up types passed to WakeUp() must then fit in 6 bits.
+#ifndef COMPACT_TCB
+#define COMPACT_TCB 0
+#endif
+
+#ifndef MAX_TASKS
+#define MAX_TASKS 8
+#endif
+
+#if COMPACT_TCB && SMP_CORES > 1
+#error "COMPACT_TCB is for single-core 8-bit targets"
+#endif
+
+// Set EDF_SCHED to 1 to dispatch the ready task with the earliest deadline instead
+// of going round robin. Messages sent with SendMsgDeadline() carry an absolute
+// deadline; other messages and timer wake-ups are due the task's relative deadline
+// after they arrive. SetTaskPeriod() releases a task every Period ticks. Ready tasks
+// are kept in a heap of MAX_TASKS entries, so InitTask() returns NULL once MAX_TASKS
+// tasks exist, and each task counts its missed deadlines.
+#ifndef EDF_SCHED
+#define EDF_SCHED 0
+#endif
+
+// Relative deadline, in ticks, of tasks that have not been given one
+#ifndef EDF_DEFAULT_DEADLINE
+#define EDF_DEFAULT_DEADLINE 0x7fff
+#endif
+
+#if EDF_SCHED && SMP_CORES > 1
+#error "EDF_SCHED keeps one ready heap and runs on a single core"
+#endif
+
+// Set KDOS_CONSOLE to 1 for the introspection console: a task that answers short
+// text commands arriving on a byte stream (see InitConsole) with the state of the
+// task rings, queues and kernel counters, while every other task keeps running.
+// Each task is copied out in its own short critical section.
+#ifndef KDOS_CONSOLE
+#define KDOS_CONSOLE 0
+#endif
+
+// In 32-bit words, like InitTask's StackSize. The host build sets its own in kdos_types.h.
+#ifndef CONSOLE_STACK_SIZE
+#define CONSOLE_STACK_SIZE 256
+#endif
+
+#ifndef CONSOLE_TASK_ID
+#define CONSOLE_TASK_ID '#'
+#endif
+
+#if KDOS_CONSOLE && !BYTE_STREAMS
+#error "KDOS_CONSOLE reads its commands from a byte stream: set BYTE_STREAMS"
+#endif
+
+#if (COMPACT_TCB || EDF_SCHED) && MAX_TASKS > 255
+#error "Task and heap indexes are 8 bits, and 255 means none"
+#endif
+
 // Structures
 // ==========
 
+#if TASK_BUDGETS
+// Record of a dispatch that held the CPU for longer than its task's budget
+struct OVERRUN
+{
+  BYTE TaskID;
+  WORD MsgType;   // Message being handled, MSG_TYPE_TIMER for timer wake-ups
+  WORD Ticks;     // How long the dispatch ran before returning to the scheduler
+};
+#endif
+
+#if BYTE_STREAMS
+struct STREAM
+{
+  BYTE *Buffer;
+  WORD Size;              // Power of two
+  volatile WORD Head;     // Free-running write index, only changed by the writer
+  volatile WORD Tail;     // Free-running read index, only changed by the reader
+  WORD Trigger;           // Bytes that make the reader runnable
+  WORD IdleTimeout;       // Ticks of silence after which fewer bytes will do, 0 = never
+  volatile WORD LastWrite; // Low word of the tick count at the last write, for IdleTimeout
+  volatile bool Notified; // Reader has a message pending and has not read since
+  struct TASK *Reader;
+  WORD MsgType;           // Sent to Reader with the byte count in lParam
+  struct STREAM *StreamNext;
+};
+#endif
+
+#if SIM_TIME
+// One dispatch in the simulated scheduler timeline
+struct SIM_EVENT
+{
+  LONG Start;     // Virtual time the task was given the CPU
+  WORD Ticks;     // Virtual time it held the CPU (only SimConsume() makes this non-zero)
+  WORD MsgType;   // MSG_TYPE_TIMER for timer and Sleep() wake-ups
+  BYTE TaskID;
+};
+#endif
+
 struct TASK
 {
   unsigned short int (*Func)(unsigned short int MsgType, unsigned short int sParam, long lParam);
-  int32_t *StackPtr;
+  void *StackPtr;            // Opaque to the kernel: set and used by the HAL
+  int32_t *StackBase;        // Kept so the stack can be recycled by DeleteTask
+  INT StackSize;
   struct MSG *MsgQueue;
+#if COMPACT_TCB
+  BYTE MsgQueueIn;           // Slot the next message goes to
+  BYTE MsgQueueOut;          // Slot of the oldest message
+  BYTE MsgCount;
+  BYTE QueueCapacity;
+  BYTE TaskID;
+  BYTE TaskNext;             // Index in the kernel's task table
+  unsigned short int Timer;
+  BYTE TimerFlag : 1;
+  BYTE Sleeping : 1;
+  BYTE WakeUpType : 6;
+#else
   struct MSG *MsgQueueIn;
   struct MSG *MsgQueueOut;
   struct MSG *MsgQueueEnd;
@@ -47,6 +215,27 @@ struct TASK
   bool Sleeping;
   struct TASK *TaskNext;
   int WakeUpType;
+#endif
+#if SMP_CORES > 1
+  BYTE Core;                 // Core whose ring the task is on
+  BYTE Affinity;             // Core set by SetTaskAffinity, or TASK_ANY_CORE
+  bool Doomed;               // DeleteTask was called while another core was running it
+#endif
+#if EDF_SCHED
+  LONG Deadline;             // Earliest deadline of its pending work: the ready heap key
+  LONG JobDeadline;          // Deadline of the dispatch in progress
+  LONG TimerDeadline;        // Deadline of the pending timer wake-up or release
+  WORD RelDeadline;          // Given to plain messages, timer wake-ups and releases
+  WORD Period;               // Ticks between releases, 0 = not periodic
+  WORD ReleaseTimer;         // Ticks to the next release
+  WORD DeadlineMisses;
+  BYTE HeapIndex;            // Position in the ready heap, or none
+#endif
+#if TASK_BUDGETS
+  WORD Budget;               // Maximum ticks per dispatch, 0 = unchecked
+  WORD OverrunCount;         // Dispatches that exceeded Budget
+  struct OVERRUN LastOverrun;
+#endif
 };
 
 struct MSG
@@ -54,7 +243,26 @@ struct MSG
   unsigned short int MsgType;
   unsigned short int sParam;
   long lParam;
+#if EDF_SCHED
+  LONG Deadline;  // Tick by which the receiving task should have handled it
+#endif
+};
+
+#if MSG_TOPICS
+struct SUBSCRIBER
+{
+  struct TASK *Task;
+  WORD Dropped;   // Publishes lost because this subscriber's queue was full
+};
+
+struct TOPIC
+{
+  struct SUBSCRIBER *Subscribers;
+  BYTE SubscriberCount;
+  BYTE MaxSubscribers;
+  struct TOPIC *TopicNext;
 };
+#endif
 
 // Prototypes
 // ==========
@@ -68,6 +276,66 @@ struct TASK *InitTask(unsigned short int (*Func)(unsigned short int MsgType, uns
                       INT QueueSize,
                       BYTE TaskID);
 void WakeUp(struct TASK *Task, INT WakeUpType);
+#if EDF_SCHED
+// Deadline is absolute, in GetTicks() time
+bool SendMsgDeadline(struct TASK *Task, WORD MsgType, WORD sParam, LONG lParam, LONG Deadline);
+// Releases Task now and then every Period ticks with MSG_TYPE_TIMER, each release due
+// Deadline ticks later (0 = Period). Period 0 only sets the relative deadline.
+// Periodic tasks should return MSG_WAIT and not Sleep() across releases.
+void SetTaskPeriod(struct TASK *Task, WORD Period, WORD Deadline);
+WORD GetDeadlineMisses(struct TASK *Task);
+#endif
+// Removes a task from the scheduler, dropping its pending messages and timer. Its
+// memory is kept for a later InitTask of the same sizes, so any pointer to it must
+// be forgotten. Deleting the calling task does not return (same as TaskExit).
+void DeleteTask(struct TASK *Task);
+void TaskExit(void);
+#if SMP_CORES > 1
+// Pins Task to Core, or lets it migrate freely with TASK_ANY_CORE
+void SetTaskAffinity(struct TASK *Task, BYTE Core);
+#endif
+#if MSG_TOPICS
+struct TOPIC *InitTopic(BYTE MaxSubscribers);
+bool Subscribe(struct TOPIC *Topic, struct TASK *Task);
+void Unsubscribe(struct TOPIC *Topic, struct TASK *Task);
+// Safe to call from an ISR. Returns the number of subscribers the message reached.
+BYTE Publish(struct TOPIC *Topic, WORD MsgType, WORD sParam, LONG lParam);
+WORD GetTopicDropped(struct TOPIC *Topic, struct TASK *Task);
+#endif
+#if BYTE_STREAMS
+struct STREAM *InitStream(WORD Size, struct TASK *Reader, WORD MsgType,
+                          WORD Trigger, WORD IdleTimeout);
+// Writer side (may be an ISR). Copying, or in place: fill the region, then commit.
+WORD StreamWrite(struct STREAM *Stream, const BYTE *Data, WORD Len);
+WORD StreamWriteRegion(struct STREAM *Stream, BYTE **Region); // Contiguous free bytes
+void StreamCommitWrite(struct STREAM *Stream, WORD Len);
+// Reader side. Reading re-arms the notification.
+WORD StreamRead(struct STREAM *Stream, BYTE *Data, WORD Len);
+WORD StreamReadRegion(struct STREAM *Stream, BYTE **Region);  // Contiguous bytes available
+void StreamCommitRead(struct STREAM *Stream, WORD Len);
+WORD StreamCount(struct STREAM *Stream);
+#endif
+#if KDOS_CONSOLE
+// Creates the console task. Received bytes go into the returned stream (from the
+// UART ISR, or HostConsole() on the host BSP); replies leave through Put, which is
+// called from the console task and never inside a critical section. NULL if the
+// console task cannot be created (EDF_SCHED with MAX_TASKS tasks).
+struct STREAM *InitConsole(void (*Put)(BYTE Byte));
+#endif
+#if SIM_TIME
+void SimRun(LONG Ticks);
+void SimConsume(WORD Ticks);
+WORD SimTimeline(struct SIM_EVENT *Events, WORD Max); // Oldest first
+LONG SimDispatches(void);
+#endif
+LONG GetTicks(void);
+#if TASK_BUDGETS
+void SetTaskBudget(struct TASK *Task, WORD Budget);
+// Hook is called from the tick ISR, once per dispatch, as soon as the running
+// task exceeds its budget. Keep it short: it runs with the task still holding the CPU.
+void SetBudgetHook(void (*Hook)(struct TASK *Task, WORD Ticks));
+bool GetLastOverrun(struct OVERRUN *Overrun);
+#endif
 
 // Stack sizes
 // ===========
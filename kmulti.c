@@ -1,4 +1,4 @@
-#include "KMulti.h"
+#include "kmulti.h"
 #include "kdos.h"
 #include <stdarg.h>
 #include <stdio.h>
@@ -4,6 +4,8 @@ import argparse
 
 TEMPLATES = {
     "stm32f4": os.path.join("templates", "stm32f4", "bsp.c"),
+    "host": os.path.join("templates", "host", "bsp.c"),
+    "avr": os.path.join("templates", "avr", "bsp.c"),
 }
 
 def list_targets():
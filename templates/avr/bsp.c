@@ -0,0 +1,138 @@
+/* AVR (ATmega) port of the KDOS HAL. Build the kernel with COMPACT_TCB=1.
+ * A saved context is r0, SREG and r1-r31 pushed on the task's own stack under
+ * the return address, so a task's stack pointer is all its TCB has to keep.
+ * The tick is Timer0 in CTC mode at 1 kHz, derived from F_CPU (clk/64, or clk/256
+ * above 16.384 MHz).
+ */
+#include "k_hal.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#ifndef F_CPU
+#error "Define F_CPU (Hz) for the Timer0 tick"
+#endif
+/* OCR0A is 8 bits: clk/64 reaches a 1 kHz tick up to 16.384 MHz, clk/256 up to 65.536 MHz */
+#if F_CPU / 64 / 1000 - 1 <= 255
+#define TICK_PRESCALER 64
+#define TICK_CS ((1 << CS01) | (1 << CS00))
+#elif F_CPU / 256 / 1000 - 1 <= 255
+#define TICK_PRESCALER 256
+#define TICK_CS (1 << CS02)
+#else
+#error "F_CPU too high for a 1 kHz Timer0 tick"
+#endif
+
+static void (*g_tick_isr)(void);
+
+void K_HAL_DisableInterrupts(void)
+{
+    cli();
+}
+
+void K_HAL_EnableInterrupts(void)
+{
+    sei();
+}
+
+/* Pushes a code address the way call does: low byte first */
+static uint8_t *PushAddress(uint8_t *sp, uint16_t addr)
+{
+    *sp-- = (uint8_t)addr;
+    *sp-- = (uint8_t)(addr >> 8);
+#if defined(__AVR_3_BYTE_PC__)
+    *sp-- = 0;
+#endif
+    return sp;
+}
+
+void *K_HAL_InitTaskStack(void *p_stack_base,
+                          unsigned int stack_size_bytes,
+                          WORD (*task_func_addr)(WORD, WORD, LONG),
+                          void (*task_exit_handler_addr)(WORD),
+                          WORD initial_msg_type,
+                          WORD initial_sparam,
+                          LONG initial_lparam)
+{
+    uint8_t *sp = (uint8_t *)p_stack_base + stack_size_bytes - 1; /* SP points at the next free byte */
+    uint8_t reg;
+
+    /* The task function returns into the exit handler with its WORD result in
+     * r24:r25, which is exactly where the handler takes its argument. */
+    sp = PushAddress(sp, (uint16_t)task_exit_handler_addr);
+    sp = PushAddress(sp, (uint16_t)task_func_addr); /* Taken by ret in K_HAL_ContextSwitch */
+
+    *sp-- = 0;    /* r0 */
+    *sp-- = 0x80; /* SREG: the task starts with interrupts enabled */
+    for (reg = 1; reg < 32; reg++) {
+        uint8_t val = 0; /* r1 must be zero for C code */
+        if (reg >= 18 && reg <= 21) {
+            val = (uint8_t)((uint32_t)initial_lparam >> (8 * (reg - 18)));  /* r18-r21 */
+        } else if (reg == 22 || reg == 23) {
+            val = (uint8_t)(initial_sparam >> (8 * (reg - 22)));            /* r22:r23 */
+        } else if (reg == 24 || reg == 25) {
+            val = (uint8_t)(initial_msg_type >> (8 * (reg - 24)));          /* r24:r25 */
+        }
+        *sp-- = val;
+    }
+
+    return sp;
+}
+
+/* Called with interrupts disabled. current_sp_storage arrives in r24:r25 and
+ * next_sp in r22:r23; both are saved with the rest before they are used. */
+__attribute__((naked)) void K_HAL_ContextSwitch(void **current_sp_storage, void *next_sp)
+{
+    __asm__ volatile (
+        "push r0\n"
+        "in r0, __SREG__\n"
+        "push r0\n"
+        "push r1\n"  "push r2\n"  "push r3\n"  "push r4\n"
+        "push r5\n"  "push r6\n"  "push r7\n"  "push r8\n"
+        "push r9\n"  "push r10\n" "push r11\n" "push r12\n"
+        "push r13\n" "push r14\n" "push r15\n" "push r16\n"
+        "push r17\n" "push r18\n" "push r19\n" "push r20\n"
+        "push r21\n" "push r22\n" "push r23\n" "push r24\n"
+        "push r25\n" "push r26\n" "push r27\n" "push r28\n"
+        "push r29\n" "push r30\n" "push r31\n"
+        "movw r30, r24\n"          /* Z = current_sp_storage */
+        "in r26, __SP_L__\n"
+        "in r27, __SP_H__\n"
+        "st Z, r26\n"
+        "std Z+1, r27\n"
+        "out __SP_L__, r22\n"      /* Interrupts are off: the two writes are atomic */
+        "out __SP_H__, r23\n"
+        "pop r31\n"  "pop r30\n"  "pop r29\n"  "pop r28\n"
+        "pop r27\n"  "pop r26\n"  "pop r25\n"  "pop r24\n"
+        "pop r23\n"  "pop r22\n"  "pop r21\n"  "pop r20\n"
+        "pop r19\n"  "pop r18\n"  "pop r17\n"  "pop r16\n"
+        "pop r15\n"  "pop r14\n"  "pop r13\n"  "pop r12\n"
+        "pop r11\n"  "pop r10\n"  "pop r9\n"   "pop r8\n"
+        "pop r7\n"   "pop r6\n"   "pop r5\n"   "pop r4\n"
+        "pop r3\n"   "pop r2\n"   "pop r1\n"
+        "pop r0\n"
+        "out __SREG__, r0\n"
+        "pop r0\n"
+        "ret\n"
+    );
+}
+
+void K_HAL_StartScheduler(void *first_task_sp)
+{
+    /* The scheduler keeps running on the startup stack; tasks are entered by K_HAL_ContextSwitch */
+    (void)first_task_sp;
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+    g_tick_isr();
+}
+
+void K_HAL_InitSystemTimer(void (*isr)(void))
+{
+    g_tick_isr = isr;
+    TCCR0A = (1 << WGM01);              /* CTC */
+    TCCR0B = TICK_CS;
+    OCR0A = (uint8_t)(F_CPU / TICK_PRESCALER / 1000 - 1);
+    TIMSK0 = (1 << OCIE0A);
+}
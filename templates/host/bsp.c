@@ -0,0 +1,306 @@
+// Host (Linux/POSIX) port of the KDOS HAL. Build with -include kdos_types.h (next
+// to this file) for the kernel's basic types; tests/ and bench/ show the full line.
+// Task contexts are ucontext_t, the system tick is SIGALRM and "interrupts" are
+// disabled by blocking that signal. Build with SIM_TIME=1 to run on the virtual
+// clock instead: the timer is then never started and the signal is never touched.
+// Host stacks must be far larger than on target (libc calls alone need several KB).
+// With SMP_CORES > 1 every virtual core is a pthread (link with -pthread); only
+// core 0 (the thread that called RunOS) takes the tick.
+// With KDOS_CONSOLE, HostConsole() puts the console on a pair of file descriptors:
+// the tick polls the input one, so it needs the real clock (or HostConsolePoll()
+// calls between SimRun()s under SIM_TIME).
+
+#include "k_hal.h"
+#include "host_bsp.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#if KDOS_CONSOLE
+#include "kdos.h"
+#include <poll.h>
+#include <unistd.h>
+#endif
+#if SMP_CORES > 1
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Lives at the base of each task's stack block; Task->StackPtr points at it
+struct HOST_CONTEXT
+{
+    ucontext_t Context;
+    WORD (*Func)(WORD, WORD, LONG);
+    void (*Exit)(WORD);
+    WORD MsgType;
+    WORD sParam;
+    LONG lParam;
+};
+
+#if SMP_CORES > 1
+#define HOST_PER_CORE __thread
+#else
+#define HOST_PER_CORE
+#endif
+
+static HOST_PER_CORE ucontext_t g_os_context;   // Context the core's scheduler runs on
+static HOST_PER_CORE ucontext_t *g_running;     // Context currently on the core
+static void (*g_timer_isr)(void);
+static bool g_timer_started = false;
+volatile unsigned long HostMaskCount;
+
+// --- Interrupt Control ---
+
+void K_HAL_DisableInterrupts(void)
+{
+    sigset_t set;
+
+    if (!g_timer_started) {
+        return;
+    }
+#if SMP_CORES > 1
+    if (K_HAL_CoreID() != 0) {
+        return; // Blocked for good on the other cores: spare the system call
+    }
+#endif
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    ++HostMaskCount; // Masked, so the tick cannot interleave with the update
+}
+
+void K_HAL_EnableInterrupts(void)
+{
+    sigset_t set;
+
+    if (!g_timer_started) {
+        return;
+    }
+#if SMP_CORES > 1
+    if (K_HAL_CoreID() != 0) {
+        return; // The tick belongs to core 0; the other cores keep it blocked
+    }
+#endif
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+// --- Multi-core ---
+
+#if SMP_CORES > 1
+static __thread BYTE g_core_id;   // 0 for the thread that called RunOS
+static void (*g_core_main)(void);
+
+BYTE K_HAL_CoreID(void)
+{
+    return g_core_id;
+}
+
+#define HOST_SPINS 100 // Tries before a waiting thread gives its CPU away
+
+void K_HAL_SpinLock(volatile INT *lock)
+{
+    int spins = 0;
+
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            // Spin on a plain load so the cache line is not bounced between cores.
+            // Virtual cores are threads: the owner may be descheduled, possibly on
+            // this very CPU, so after a while let it run.
+            if (++spins >= HOST_SPINS) {
+                spins = 0;
+                sched_yield();
+            }
+        }
+    }
+}
+
+void K_HAL_SpinUnlock(volatile INT *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+void K_HAL_CoreIdle(void)
+{
+    sched_yield();
+}
+
+static void *HostCoreThread(void *arg)
+{
+    g_core_id = (BYTE)(uintptr_t)arg;
+    g_running = &g_os_context;
+    g_core_main();
+    return NULL;
+}
+
+void K_HAL_StartCores(void (*core_main)(void))
+{
+    pthread_t thread;
+    sigset_t set, old;
+    uintptr_t core;
+
+    g_core_main = core_main;
+    // New threads inherit the creator's mask: start them with the tick blocked
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    for (core = 1; core < SMP_CORES; core++) {
+        pthread_create(&thread, NULL, HostCoreThread, (void *)core);
+        pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+#endif
+
+// --- Context Switching & Task Initialization ---
+
+// makecontext only passes int arguments, so the context pointer is split in two
+static void HostTaskEntry(unsigned int hi, unsigned int lo)
+{
+    struct HOST_CONTEXT *ctx =
+        (struct HOST_CONTEXT *)(((uintptr_t)hi << 16 << 16) | (uintptr_t)lo);
+
+#if SMP_CORES == 1
+    // The context was captured inside the scheduler's critical section. On SMP
+    // builds the kernel's own task entry leaves it, together with the kernel lock.
+    K_HAL_EnableInterrupts();
+#endif
+    ctx->Exit(ctx->Func(ctx->MsgType, ctx->sParam, ctx->lParam));
+}
+
+void *K_HAL_InitTaskStack(void *p_stack_base,
+                          unsigned int stack_size_bytes,
+                          WORD (*task_func_addr)(WORD, WORD, LONG),
+                          void (*task_exit_handler_addr)(WORD),
+                          WORD initial_msg_type,
+                          WORD initial_sparam,
+                          LONG initial_lparam)
+{
+    struct HOST_CONTEXT *ctx = (struct HOST_CONTEXT *)p_stack_base;
+    uintptr_t addr = (uintptr_t)ctx;
+
+    if (stack_size_bytes <= sizeof(struct HOST_CONTEXT)) {
+        return NULL;
+    }
+    if (getcontext(&ctx->Context) != 0) {
+        return NULL;
+    }
+    ctx->Func = task_func_addr;
+    ctx->Exit = task_exit_handler_addr;
+    ctx->MsgType = initial_msg_type;
+    ctx->sParam = initial_sparam;
+    ctx->lParam = initial_lparam;
+    ctx->Context.uc_stack.ss_sp = (char *)p_stack_base + sizeof(struct HOST_CONTEXT);
+    ctx->Context.uc_stack.ss_size = stack_size_bytes - sizeof(struct HOST_CONTEXT);
+    ctx->Context.uc_link = NULL; // The exit handler never returns
+    makecontext(&ctx->Context, (void (*)(void))HostTaskEntry, 2,
+                (unsigned int)(addr >> 16 >> 16), (unsigned int)addr);
+    return ctx;
+}
+
+void K_HAL_ContextSwitch(void **p_current_task_sp_storage, void *next_task_sp_val)
+{
+    ucontext_t *from = g_running ? g_running : &g_os_context;
+
+    *p_current_task_sp_storage = from;
+    g_running = (ucontext_t *)next_task_sp_val;
+    swapcontext(from, g_running);
+}
+
+void K_HAL_StartScheduler(void *first_task_stack_ptr)
+{
+    // The scheduler simply keeps running on the caller's (main's) stack
+    (void)first_task_stack_ptr;
+    g_running = &g_os_context;
+}
+
+// --- System Timer ---
+
+static void HostTimerSignal(int sig)
+{
+    int saved_errno = errno; // The interrupted code may be about to read it
+
+    (void)sig;
+#if KDOS_CONSOLE
+    HostConsolePoll();
+#endif
+    g_timer_isr();
+    errno = saved_errno;
+}
+
+void K_HAL_InitSystemTimer(void (*timer_isr_addr)(void))
+{
+    struct sigaction sa;
+    struct itimerval period;
+
+    g_timer_isr = timer_isr_addr;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = HostTimerSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, NULL);
+
+    g_timer_started = true;
+
+    period.it_interval.tv_sec = 0;
+    period.it_interval.tv_usec = 1000; // 1ms KDOS tick
+    period.it_value = period.it_interval;
+    setitimer(ITIMER_REAL, &period, NULL);
+}
+
+// --- Console on file descriptors ---
+
+#if KDOS_CONSOLE
+static struct STREAM *g_console_in;
+static int g_console_in_fd = -1;   // -1 once it has reached end of file
+static int g_console_out_fd = -1;
+
+// Called by the console task, never inside a critical section
+static void HostConsolePut(BYTE Byte)
+{
+    while (write(g_console_out_fd, &Byte, 1) < 0 && errno == EINTR) {
+    }
+}
+
+struct STREAM *HostConsole(int in_fd, int out_fd)
+{
+    g_console_out_fd = out_fd;
+    g_console_in = InitConsole(HostConsolePut);
+    if (g_console_in) {
+        g_console_in_fd = in_fd;
+    }
+    return g_console_in;
+}
+
+// The stream's writer. poll() and read() are async-signal-safe, and bytes that do
+// not fit now stay in the descriptor for the next tick.
+void HostConsolePoll(void)
+{
+    struct pollfd pfd;
+    BYTE *region;
+    WORD room;
+    ssize_t got;
+
+    if (g_console_in_fd < 0) {
+        return;
+    }
+    pfd.fd = g_console_in_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0) {
+        return;
+    }
+    room = StreamWriteRegion(g_console_in, &region);
+    if (room == 0) {
+        return;
+    }
+    got = read(g_console_in_fd, region, room);
+    if (got > 0) {
+        StreamCommitWrite(g_console_in, (WORD)got);
+    } else if (got == 0 || (errno != EINTR && errno != EAGAIN)) {
+        g_console_in_fd = -1; // End of file or a dead descriptor: stop polling
+    }
+}
+#endif
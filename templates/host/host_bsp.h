@@ -0,0 +1,22 @@
+// Host-only extras of the host BSP (bsp.c next to this file), for the programs in
+// tests/ and bench/. Targets have no equivalent.
+#ifndef HOST_BSP_H_INCLUDED
+#define HOST_BSP_H_INCLUDED
+
+// Times the BSP has actually masked the tick: K_HAL_DisableInterrupts() calls on
+// core 0 once the timer runs, the tick ISR's own included. Zero under SIM_TIME.
+extern volatile unsigned long HostMaskCount;
+
+#if KDOS_CONSOLE
+struct STREAM;
+
+// Starts the console (InitConsole) with its input read from in_fd and its replies
+// written to out_fd, e.g. STDIN_FILENO and STDOUT_FILENO, or the ends of two pipes.
+// The tick polls in_fd until end of file. NULL if the console task cannot be created.
+struct STREAM *HostConsole(int in_fd, int out_fd);
+// Moves what in_fd has ready into the console stream. The tick calls it; under
+// SIM_TIME call it between SimRun()s.
+void HostConsolePoll(void);
+#endif
+
+#endif // HOST_BSP_H_INCLUDED
@@ -0,0 +1,21 @@
+// Basic KDOS types for the host build. Targets normally get these from their
+// processor header; a host build force-includes this file instead.
+#ifndef KDOS_TYPES_H_INCLUDED
+#define KDOS_TYPES_H_INCLUDED
+
+#include <stdint.h>
+
+typedef uint16_t WORD;
+typedef long LONG;
+typedef int INT;
+typedef uint8_t BYTE;
+
+#define TRUE 1
+#define FALSE 0
+
+// Host stacks carry a ucontext_t and libc frames, far more than the target default
+#ifndef CONSOLE_STACK_SIZE
+#define CONSOLE_STACK_SIZE 2048
+#endif
+
+#endif // KDOS_TYPES_H_INCLUDED
@@ -1,6 +1,23 @@
+/* Cortex-M3/M4(F) port of the KDOS HAL.
+ * Tasks run on PSP, the scheduler loop and handlers on MSP. Every switch is done
+ * by PendSV at the lowest exception priority, so it tail-chains behind any pending
+ * interrupt and works on the hardware exception frame: r0-r3, r12, lr, pc, xPSR are
+ * stacked by the core, PendSV only saves r4-r11 and EXC_RETURN. On parts with an
+ * FPU, s16-s31 are saved only for contexts whose EXC_RETURN bit 4 is clear, i.e.
+ * that have actually executed an FP instruction; lazy stacking (FPCCR.LSPEN) also
+ * skips the hardware s0-s15 copy until the next context touches the FPU.
+ */
 #include "k_hal.h"
 #include "stm32f4xx.h"
 
+#define EXC_RETURN_THREAD_PSP 0xFFFFFFFDU /* Thread mode, PSP, basic frame */
+
+/* Hand-over to PendSV_Handler */
+void **volatile g_switch_save;
+void *volatile g_switch_next;
+
+static void (*g_tick_isr)(void);
+
 void K_HAL_DisableInterrupts(void)
 {
     __disable_irq();
@@ -13,7 +30,7 @@ void K_HAL_EnableInterrupts(void)
 
 void *K_HAL_InitTaskStack(void *p_stack_base,
                           unsigned int stack_size_bytes,
-                          void (*task_func_addr)(WORD, WORD, LONG),
+                          WORD (*task_func_addr)(WORD, WORD, LONG),
                           void (*task_exit_handler_addr)(WORD),
                           WORD initial_msg_type,
                           WORD initial_sparam,
@@ -23,8 +40,8 @@ void *K_HAL_InitTaskStack(void *p_stack_base,
     sp = (uint32_t *)((uint32_t)sp & ~0x7U); /* 8-byte alignment */
 
     /* Automatic stacking as performed on exception entry */
-    *--sp = 0x01000000U;                 /* xPSR */
-    *--sp = (uint32_t)task_func_addr;     /* PC */
+    *--sp = 0x01000000U;                 /* xPSR: Thumb bit */
+    *--sp = (uint32_t)task_func_addr & ~1U; /* PC */
     *--sp = (uint32_t)task_exit_handler_addr; /* LR */
     *--sp = 0; /* R12 */
     *--sp = 0; /* R3 */
@@ -32,7 +49,8 @@ void *K_HAL_InitTaskStack(void *p_stack_base,
     *--sp = initial_sparam; /* R1 */
     *--sp = initial_msg_type; /* R0 */
 
-    /* Remaining registers R4-R11 saved by context switch */
+    /* Saved by PendSV_Handler: EXC_RETURN, then R11-R4 */
+    *--sp = EXC_RETURN_THREAD_PSP;
     for (int i = 0; i < 8; ++i) {
         *--sp = 0;
     }
@@ -40,35 +58,79 @@ void *K_HAL_InitTaskStack(void *p_stack_base,
     return sp;
 }
 
-__attribute__((naked)) void K_HAL_ContextSwitch(void **current_sp_storage, void *next_sp)
+/* Called with interrupts disabled, from the scheduler, a task or an ISR.
+ * From thread mode, PendSV is taken as soon as interrupts are opened and this
+ * context resumes here when it is switched back in. From an ISR the switch is
+ * only pended and happens when the last nested handler returns. */
+void K_HAL_ContextSwitch(void **current_sp_storage, void *next_sp)
 {
-    __asm volatile (
-        "mrs r2, psp\n"           /* Get current process stack pointer */
-        "stmdb r2!, {r4-r11}\n"  /* Save callee-saved registers */
-        "str r2, [r0]\n"        /* Store current SP */
-        "ldr r2, [r1]\n"        /* Load next SP */
-        "ldmia r2!, {r4-r11}\n" /* Restore callee-saved regs */
-        "msr psp, r2\n"         /* Set PSP to new task */
-        "bx lr\n"               /* Return */
-    );
+    g_switch_save = current_sp_storage;
+    g_switch_next = next_sp;
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    if (__get_IPSR() == 0) {
+        __DSB();
+        __enable_irq();
+        __ISB();
+        __disable_irq(); /* Back in this context: the caller expects them off */
+    }
 }
 
-__attribute__((naked)) void K_HAL_StartScheduler(void *first_task_sp)
+__attribute__((naked)) void PendSV_Handler(void)
 {
     __asm volatile (
-        "msr psp, %0\n"          /* Set PSP to task stack */
-        "movs r0, #2\n"
-        "msr CONTROL, r0\n"      /* Switch to PSP */
-        "isb\n"
-        "pop {r4-r11}\n"        /* Pop initial r4-r11 */
-        "pop {r0-r3, r12, lr, pc}\n" /* Pop remaining regs and start task */
-        : : "r" (first_task_sp) : "memory"
+        "cpsid i\n"
+        "tst lr, #4\n"                /* Which stack holds the outgoing frame? */
+        "ite eq\n"
+        "mrseq r0, msp\n"
+        "mrsne r0, psp\n"
+#if defined(__FPU_USED) && (__FPU_USED == 1)
+        "tst lr, #0x10\n"             /* Bit 4 clear: context used the FPU */
+        "it eq\n"
+        "vstmdbeq r0!, {s16-s31}\n"
+#endif
+        "stmdb r0!, {r4-r11, lr}\n"
+        "tst lr, #4\n"                /* Scheduler on MSP: keep handlers below */
+        "it eq\n"                     /* its saved registers */
+        "msreq msp, r0\n"
+        "movw r1, #:lower16:g_switch_save\n"
+        "movt r1, #:upper16:g_switch_save\n"
+        "ldr r1, [r1]\n"
+        "str r0, [r1]\n"
+        "movw r1, #:lower16:g_switch_next\n"
+        "movt r1, #:upper16:g_switch_next\n"
+        "ldr r0, [r1]\n"
+        "ldmia r0!, {r4-r11, lr}\n"
+#if defined(__FPU_USED) && (__FPU_USED == 1)
+        "tst lr, #0x10\n"
+        "it eq\n"
+        "vldmiaeq r0!, {s16-s31}\n"
+#endif
+        "tst lr, #4\n"
+        "ite eq\n"
+        "msreq msp, r0\n"
+        "msrne psp, r0\n"
+        "cpsie i\n"
+        "bx lr\n"
     );
-    for(;;);
+}
+
+void K_HAL_StartScheduler(void *first_task_sp)
+{
+    /* The scheduler keeps running on MSP; tasks are entered by K_HAL_ContextSwitch */
+    (void)first_task_sp;
+    NVIC_SetPriority(PendSV_IRQn, (1U << __NVIC_PRIO_BITS) - 1U);
+#if defined(__FPU_USED) && (__FPU_USED == 1)
+    FPU->FPCCR |= FPU_FPCCR_ASPEN_Msk | FPU_FPCCR_LSPEN_Msk;
+#endif
+}
+
+void SysTick_Handler(void)
+{
+    g_tick_isr();
 }
 
 void K_HAL_InitSystemTimer(void (*isr)(void))
 {
+    g_tick_isr = isr;
     SysTick_Config(SystemCoreClock / 1000);
-    (void)isr; /* vector table should point to isr */
 }
@@ -0,0 +1,37 @@
+// Shared by the KDOS host tests and benchmarks: the application hooks the kernel
+// expects (kmulti.c provides them on target) and a CHECK macro. Each program is
+// one translation unit next to Kdos.c and the host BSP.
+#ifndef KTEST_H_INCLUDED
+#define KTEST_H_INCLUDED
+
+#include "kmulti.h"
+#include "kdos.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static int ktest_failures __attribute__((unused));
+
+void Emergency(const char *Msg)
+{
+    printf("EMERGENCY: %s\n", Msg);
+    exit(2);
+}
+
+void DebugPrintf(const char *Format, ...)
+{
+    (void)Format;
+}
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);  \
+            ++ktest_failures;                                                \
+        }                                                                    \
+    } while (0)
+
+// Prints the verdict and gives main() its exit status
+#define TEST_END() \
+    (printf("%s: %s\n", __FILE__, ktest_failures ? "FAIL" : "ok"), ktest_failures != 0)
+
+#endif // KTEST_H_INCLUDED
@@ -0,0 +1,70 @@
+// A slow task overruns its budget on every dispatch next to a task that keeps
+// within it. The hook must fire once per overrunning dispatch, while the slow
+// task still holds the CPU, and only the slow task may be charged.
+#include "ktest.h"
+
+static struct TASK *Slow, *Quick;
+static int hooks;
+static struct TASK *hook_task;
+static WORD hook_ticks;
+static LONG hook_at;
+
+static void Hook(struct TASK *Task, WORD Ticks)
+{
+    ++hooks;
+    hook_task = Task;
+    hook_ticks = Ticks;
+    hook_at = GetTicks();
+}
+
+static WORD SlowTask(WORD MsgType, WORD sParam, LONG lParam)
+{
+    int i;
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+    for (i = 0; i < 5; i++) {
+        SimConsume(10); // 50 ticks against a budget of 20, in steps the hook can see
+    }
+    return 100;
+}
+
+static WORD QuickTask(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+    SimConsume(5);
+    return 100;
+}
+
+int main(void)
+{
+    struct OVERRUN o;
+
+    Slow = InitTask(SlowTask, 2048, 4, 'S');
+    Quick = InitTask(QuickTask, 2048, 4, 'Q');
+    SetTaskBudget(Slow, 20);
+    SetTaskBudget(Quick, 20);
+    SetBudgetHook(Hook);
+    CHECK(!GetLastOverrun(&o));
+
+    SendMsg(Slow, 7, 0, 0);
+    SendMsg(Quick, 7, 0, 0);
+    SimRun(1000L);
+
+    // Slow runs for 50 ticks and sleeps 100, so at 0, 150, ..., 900
+    CHECK(Slow->OverrunCount == 7);
+    CHECK(Quick->OverrunCount == 0);
+    CHECK(hooks == 7);
+    CHECK(hook_task == Slow);
+    CHECK(hook_ticks == 30);           // First step past the budget, not the full 50
+    CHECK(hook_at == 900 + 30);    // Reported before the dispatch ended
+
+    CHECK(GetLastOverrun(&o));
+    CHECK(o.TaskID == 'S');
+    CHECK(o.Ticks == 50);
+    CHECK(o.MsgType == MSG_TYPE_TIMER);
+    CHECK(Slow->LastOverrun.Ticks == 50);
+    return TEST_END();
+}
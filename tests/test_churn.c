@@ -0,0 +1,107 @@
+// Spawn/exit churn: a spawner runs every tick and creates short-lived tasks. A
+// worker exits itself on its first message. A parked task arms a 50-tick timer,
+// and the next tick it is sent a message and deleted in the same dispatch, so it
+// dies with both pending. A sleeper is deleted inside Sleep(). Neither may ever
+// run again, each new parked task and sleeper must get the memory of the one
+// just deleted, and once the pools are warm the heap must stay flat.
+#include "ktest.h"
+#include <malloc.h>
+
+static struct TASK *Parked, *Sleeper;
+static long spawned, exited, deleted, parked, asleep, stale, reused;
+
+static WORD Worker(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == 9) {
+        ++exited;
+        TaskExit();
+    }
+    return MSG_WAIT;
+}
+
+static WORD ParkedTask(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == MSG_TYPE_INIT) {
+        ++parked;
+        return 50;
+    }
+    ++stale; // Its message or its timer outlived DeleteTask
+    return MSG_WAIT;
+}
+
+static WORD SleeperTask(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+    ++asleep;
+    Sleep(50, TASK_SWITCH_PERMIT);
+    ++stale; // Deleted tasks never come back from Sleep()
+    return MSG_WAIT;
+}
+
+static WORD Spawner(WORD MsgType, WORD sParam, LONG lParam)
+{
+    struct TASK *t, *old;
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+
+    t = InitTask(Worker, 1024, 4, 'w');
+    SendMsg(t, 9, 0, 0);
+    spawned++;
+
+    old = Parked;
+    if (Parked) {
+        SendMsg(Parked, 10, 0, 0);
+        DeleteTask(Parked);
+        ++deleted;
+    }
+    Parked = InitTask(ParkedTask, 2048, 8, 'p');
+    SendMsg(Parked, MSG_TYPE_INIT, 0, 0);
+    reused += (old && Parked == old);
+
+    old = Sleeper;
+    if (Sleeper) {
+        DeleteTask(Sleeper);
+        ++deleted;
+    }
+    Sleeper = InitTask(SleeperTask, 1536, 2, 'z');
+    SendMsg(Sleeper, MSG_TYPE_INIT, 0, 0);
+    reused += (old && Sleeper == old);
+
+    spawned += 2;
+    return 1;
+}
+
+int main(void)
+{
+    size_t warm, after;
+
+    struct TASK *s = InitTask(Spawner, 2048, 4, 'S');
+    SendMsg(s, MSG_TYPE_INIT, 0, 0);
+
+    SimRun(1000L);
+    warm = mallinfo2().uordblks;
+
+    SimRun(100000L);
+    after = mallinfo2().uordblks;
+
+    // One spawner dispatch per tick, ticks 0 .. 100999; the victims run right after it
+    CHECK(spawned == 3 * 101000L);
+    CHECK(exited == 101000L);
+    CHECK(parked == 101000L);
+    CHECK(asleep == 101000L);
+    CHECK(deleted == 2 * (101000L - 1));
+    CHECK(stale == 0);
+    CHECK(reused == 2 * (101000L - 1));
+    CHECK(after == warm);
+    if (after != warm) {
+        printf("heap in use: %zu after warm-up, %zu after churn\n", warm, after);
+    }
+    return TEST_END();
+}
@@ -0,0 +1,67 @@
+// Console commands fed through its stream on the SIM_TIME clock, replies caught
+// by the Put callback. A sleeps on two queued messages carrying LONG_MAX and
+// LONG_MIN, the widest numbers the console has to print.
+#include "ktest.h"
+#include <limits.h>
+#include <string.h>
+
+static char Out[4096];
+static size_t OutLen;
+static struct STREAM *In;
+static struct TASK *A;
+
+static void Put(BYTE Byte)
+{
+    if (OutLen < sizeof(Out) - 1) { Out[OutLen++] = (char)Byte; }
+}
+
+static WORD TaskA(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == MSG_TYPE_INIT) { Sleep(MSG_WAIT, TASK_SWITCH_PERMIT); }
+    return MSG_WAIT;
+}
+
+// Sends one command line and returns what the console answered
+static const char *Command(const char *Line)
+{
+    OutLen = 0;
+    StreamWrite(In, (const BYTE *)Line, (WORD)strlen(Line));
+    SimRun(10);
+    Out[OutLen] = 0;
+    return Out;
+}
+
+int main(void)
+{
+    const char *r;
+    char Want[128];
+
+    A = InitTask(TaskA, 2048, 4, 'A');
+    In = InitConsole(Put);
+    CHECK(In != NULL);
+    SendMsg(A, MSG_TYPE_INIT, 0, 0);
+    SimRun(10);
+    SendMsg(A, 40, 7, LONG_MAX);
+    SendMsg(A, 41, 8, LONG_MIN);
+
+    r = Command("q A\n");
+    snprintf(Want, sizeof(Want), "0 type=40 s=7 l=%ld\r\n1 type=41 s=8 l=%ld\r\n", LONG_MAX, LONG_MIN);
+    CHECK(strcmp(r, Want) == 0);
+
+    r = Command("t\n");
+    CHECK(strstr(r, "A S  timer=0 flag=0 q=2/4\r\n") != NULL);
+    CHECK(strstr(r, "# W* timer=0 flag=0 q=0/2\r\n") != NULL); // Running, its input consumed
+
+    r = Command("q Z\n");
+    CHECK(strcmp(r, "? no such task\r\n") == 0);
+
+    r = Command("c\n");
+    CHECK(strncmp(r, "ticks=", 6) == 0);
+    CHECK(strstr(r, " tasks=2 ") != NULL);
+
+    r = Command("x\n");
+    CHECK(strcmp(r, "? h for help\r\n") == 0);
+    return TEST_END();
+}
@@ -0,0 +1,72 @@
+// The console on file descriptors (HostConsole), on the real clock: commands
+// written into one pipe reach the console through the tick's poll, and the
+// replies come out of another, as they would over stdin and stdout. Closing the
+// write end ends the polling.
+#include "ktest.h"
+#include "../templates/host/host_bsp.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static int In[2], Out[2];
+static char Got[4096];
+
+static void Send(const char *Line)
+{
+    CHECK(write(In[1], Line, strlen(Line)) == (ssize_t)strlen(Line));
+}
+
+// Everything the console has answered since the last call
+static const char *Reply(void)
+{
+    ssize_t n = read(Out[0], Got, sizeof(Got) - 1);
+    Got[n > 0 ? n : 0] = 0;
+    return Got;
+}
+
+// One step per wake-up, 100 ticks apart to let the console answer
+static WORD Driver(WORD MsgType, WORD sParam, LONG lParam)
+{
+    static int Step;
+    const char *r;
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+
+    switch (Step++) {
+    case 0:
+        Send("c\n");
+        break;
+    case 1:
+        r = Reply();
+        CHECK(strncmp(r, "ticks=", 6) == 0);
+        CHECK(strstr(r, " tasks=2 ") != NULL);
+        // Split across ticks: the console still sees one line
+        Send("q ");
+        break;
+    case 2:
+        CHECK(strcmp(Reply(), "") == 0);
+        Send("Z\nx\n");
+        break;
+    case 3:
+        CHECK(strcmp(Reply(), "? no such task\r\n? h for help\r\n") == 0);
+        close(In[1]);
+        break;
+    default:
+        exit(TEST_END());
+    }
+    return 100;
+}
+
+int main(void)
+{
+    struct TASK *d;
+
+    CHECK(pipe(In) == 0 && pipe(Out) == 0);
+    fcntl(Out[0], F_SETFL, O_NONBLOCK);
+    d = InitTask(Driver, 2048, 2, 'D');
+    CHECK(HostConsole(In[0], Out[1]) != NULL);
+    SendMsg(d, MSG_TYPE_INIT, 0, 0);
+    RunOS();
+    return 1;
+}
@@ -0,0 +1,196 @@
+// Two job sets, each run under round robin (test_edf_rr) and EDF_SCHED (test_edf).
+//
+// Mixed: one urgent job every 10 ticks, due 4 ticks after release, and four
+// background jobs of 3 ticks each every 40 ticks, due 40 ticks after release. All
+// five are released together at multiples of 40. Round robin runs the four
+// background jobs ahead of the urgent one there, so that release is always late;
+// EDF takes the urgent job first and meets every deadline. A release task sends each job with its
+// intended release time, so a late release cannot hide a miss.
+//
+// Sweep: three jobs with periods 10, 20 and 40, each due at its next release, at
+// utilisations from 0.3 to 1.1. Under EDF the kernel releases them (SetTaskPeriod)
+// and counts the misses (GetDeadlineMisses), which must stay 0 up to U = 1 and not
+// above it. Under round robin the release task sends them as above.
+// EDF here is non-preemptive, so U <= 1 is not enough on its own: a job longer than
+// the shortest period's slack can start just before that job's release and make
+// it late. The sweep sets avoid that; Blocked is such a set, at U = 0.6.
+#include "ktest.h"
+
+#define JOBS    5
+#define HORIZON 4000L
+#define SWEEPS  5
+#define SWEEP_JOBS    3
+#define SWEEP_HORIZON 4000L
+
+struct JOB
+{
+    WORD Period, Cost, Deadline;
+};
+
+static const struct JOB Mixed[JOBS] = {
+    { 40, 3, 40 },
+    { 40, 3, 40 },
+    { 40, 3, 40 },
+    { 40, 3, 40 },
+    { 10, 1, 4 },
+};
+
+// Utilisation in tenths, then the jobs
+static const struct
+{
+    int U;
+    struct JOB Jobs[SWEEP_JOBS];
+} Sweep[SWEEPS] = {
+    { 3,  { { 10, 1, 10 }, { 20, 2, 20 }, { 40, 4, 40 } } },
+    { 6,  { { 10, 2, 10 }, { 20, 4, 20 }, { 40, 8, 40 } } },
+    { 9,  { { 10, 6, 10 }, { 20, 4, 20 }, { 40, 4, 40 } } },
+    { 10, { { 10, 4, 10 }, { 20, 6, 20 }, { 40, 12, 40 } } },
+    { 11, { { 10, 4, 10 }, { 20, 6, 20 }, { 40, 16, 40 } } },
+};
+
+// Released together, the 40-tick job runs 4..16, and the 10-tick job released at
+// 10 and due at 15 finishes at 18: late once every 40 ticks, but done before its
+// next release
+static const struct JOB Blocked[SWEEP_JOBS] = { { 10, 2, 5 }, { 20, 2, 20 }, { 40, 12, 40 } };
+
+static const struct JOB *Set;   // The job set being run
+static WORD SetSize;
+static LONG Horizon;            // The release task sends nothing due after this
+static struct TASK *Jobs[JOBS];
+static LONG Next[JOBS];
+static int Done[JOBS];
+static int Late[JOBS];
+
+// Job i: a message from the release task, or a kernel release of a periodic task
+static WORD Job(int i, WORD MsgType, LONG lParam)
+{
+    if (MsgType == 30 || MsgType == MSG_TYPE_TIMER) {
+        SimConsume(Set[i].Cost);
+        ++Done[i];
+        if (MsgType == 30 && GetTicks() > lParam) { ++Late[i]; }
+    }
+    return MSG_WAIT;
+}
+
+// A periodic release carries no parameters, so each job has its own function
+static WORD Job0(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Job(0, MsgType, lParam); }
+static WORD Job1(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Job(1, MsgType, lParam); }
+static WORD Job2(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Job(2, MsgType, lParam); }
+static WORD Job3(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Job(3, MsgType, lParam); }
+static WORD Job4(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Job(4, MsgType, lParam); }
+
+static WORD (*const JobFuncs[JOBS])(WORD, WORD, LONG) = { Job0, Job1, Job2, Job3, Job4 };
+
+static WORD Release(WORD MsgType, WORD sParam, LONG lParam)
+{
+    WORD i;
+    bool More = false;
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+    for (i = 0; i < SetSize; i++) {
+        while (Next[i] <= GetTicks() && Next[i] < Horizon) {
+#if EDF_SCHED
+            SendMsgDeadline(Jobs[i], 30, i, Next[i] + Set[i].Deadline, Next[i] + Set[i].Deadline);
+#else
+            SendMsg(Jobs[i], 30, i, Next[i] + Set[i].Deadline);
+#endif
+            Next[i] += Set[i].Period;
+        }
+        if (Next[i] < Horizon) { More = true; }
+    }
+    return More ? 1 : MSG_WAIT;
+}
+
+// Starts a job set at the current time
+static void Begin(const struct JOB *Jobs_, WORD Size, LONG Span)
+{
+    WORD i;
+    Set = Jobs_;
+    SetSize = Size;
+    Horizon = GetTicks() + Span;
+    for (i = 0; i < Size; i++) {
+        Next[i] = GetTicks();
+        Done[i] = 0;
+        Late[i] = 0;
+    }
+}
+
+// Runs a three-job set; returns the jobs that missed their deadline
+static int RunSweep(struct TASK *r, const struct JOB *Jobs_)
+{
+    int i, late = 0;
+
+    Begin(Jobs_, SWEEP_JOBS, SWEEP_HORIZON);
+#if EDF_SCHED
+    (void)r;
+    for (i = 0; i < SWEEP_JOBS; i++) { late -= GetDeadlineMisses(Jobs[i]); }
+    for (i = 0; i < SWEEP_JOBS; i++) { SetTaskPeriod(Jobs[i], Set[i].Period, Set[i].Deadline); }
+    SimRun(SWEEP_HORIZON);
+    for (i = 0; i < SWEEP_JOBS; i++) { SetTaskPeriod(Jobs[i], 0, Set[i].Deadline); } // No more releases
+    SimRun(100);
+    for (i = 0; i < SWEEP_JOBS; i++) { late += GetDeadlineMisses(Jobs[i]); }
+#else
+    SendMsg(r, MSG_TYPE_INIT, 0, 0);
+    SimRun(SWEEP_HORIZON + 100);
+    for (i = 0; i < SWEEP_JOBS; i++) { late += Late[i]; }
+#endif
+    return late;
+}
+
+int main(void)
+{
+    struct TASK *r;
+    int i, k, late = 0, urgent_late, swept[SWEEPS];
+
+    for (i = 0; i < JOBS; i++) { Jobs[i] = InitTask(JobFuncs[i], 2048, 8, 'a' + i); }
+    r = InitTask(Release, 2048, 4, 'R');
+#if EDF_SCHED
+    SetTaskPeriod(r, 0, 1); // Its timer wake-ups are due at once
+    // The heap has MAX_TASKS slots: InitTask refuses more tasks than that
+    for (i = JOBS + 1; i < MAX_TASKS; i++) { CHECK(InitTask(Job0, 2048, 1, 'x') != NULL); }
+    CHECK(InitTask(Job0, 2048, 1, 'x') == NULL);
+#endif
+    Begin(Mixed, JOBS, HORIZON);
+    SendMsg(r, MSG_TYPE_INIT, 0, 0);
+
+    SimRun(HORIZON + 100);
+
+    for (i = 0; i < JOBS; i++) {
+        CHECK(Done[i] == HORIZON / Set[i].Period);
+        late += Late[i];
+#if EDF_SCHED
+        CHECK(GetDeadlineMisses(Jobs[i]) == 0);
+#endif
+    }
+    urgent_late = Late[JOBS - 1];
+#if EDF_SCHED
+    CHECK(late == 0);
+#else
+    CHECK(urgent_late == HORIZON / 40); // Behind 12 ticks of background work at every 40
+    CHECK(late == urgent_late);
+#endif
+    printf("%s: %d of %d urgent jobs late, %d late in all\n", EDF_SCHED ? "EDF" : "round robin",
+           urgent_late, Done[JOBS - 1], late);
+
+    printf("%s sweep, late jobs at U =", EDF_SCHED ? "EDF" : "round robin");
+    for (k = 0; k < SWEEPS; k++) {
+        swept[k] = RunSweep(r, Sweep[k].Jobs);
+        if (Sweep[k].U <= 10) {
+            for (i = 0; i < SWEEP_JOBS; i++) { CHECK(Done[i] >= SWEEP_HORIZON / Set[i].Period); }
+        }
+        printf(" %d.%d: %d%s", Sweep[k].U / 10, Sweep[k].U % 10, swept[k], k < SWEEPS - 1 ? "," : "\n");
+    }
+#if EDF_SCHED
+    for (k = 0; k < SWEEPS; k++) {
+        if (Sweep[k].U <= 10) { CHECK(swept[k] == 0); }
+        else { CHECK(swept[k] > 0); }
+    }
+#else
+    CHECK(swept[0] == 0);
+    CHECK(swept[SWEEPS - 2] > 0); // U = 1: EDF meets it, round robin does not
+    CHECK(swept[SWEEPS - 1] > 0);
+#endif
+    CHECK(RunSweep(r, Blocked) == SWEEP_HORIZON / 40);
+    return TEST_END();
+}
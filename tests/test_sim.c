@@ -0,0 +1,107 @@
+// One hour of virtual time with a fixed script: A ticks every second and feeds
+// B and C, C sleeps and consumes virtual CPU time. Every count and time below is
+// exact because the simulator's interleaving is deterministic. The test is also
+// built with COMPACT_TCB=1 (test_sim_compact), and both builds must produce the
+// same digest of the full dispatch timeline.
+#include "ktest.h"
+
+static struct TASK *A, *B, *C;
+static int na, nb, nc;
+static LONG b_last_at;
+static WORD b_last_s;
+static unsigned long digest = 2166136261UL;
+
+// FNV-1a over every dispatch: start, length, message type and task
+static void Fold(const struct SIM_EVENT *e)
+{
+    unsigned long v[4];
+    int i;
+    v[0] = (unsigned long)e->Start;
+    v[1] = e->Ticks;
+    v[2] = e->MsgType;
+    v[3] = e->TaskID;
+    for (i = 0; i < 4; i++) {
+        digest = ((digest ^ v[i]) * 16777619UL) & 0xffffffffUL;
+    }
+}
+
+static WORD TaskA(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == MSG_TYPE_TIMER) {
+        ++na;
+        if (na % 10 == 0) { SendMsg(B, 5, (WORD)na, 0); }
+        if (na % 100 == 0) { SendMsg(C, 6, 0, 0); }
+    }
+    return 1000;
+}
+
+static WORD TaskB(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)lParam;
+    if (MsgType == 5) {
+        ++nb;
+        b_last_at = GetTicks();
+        b_last_s = sParam;
+    }
+    return MSG_WAIT;
+}
+
+static WORD TaskC(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == 6) {
+        ++nc;
+        Sleep(250, TASK_SWITCH_PERMIT);
+        Sleep(250, TASK_SWITCH_PERMIT);
+        SimConsume(10);
+    }
+    return MSG_WAIT;
+}
+
+int main(void)
+{
+    struct SIM_EVENT ev[SIM_TIMELINE_SIZE];
+    WORD n, i;
+    LONG seen = 0, t;
+
+    A = InitTask(TaskA, 2048, 4, 'A');
+    B = InitTask(TaskB, 2048, 4, 'B');
+    C = InitTask(TaskC, 2048, 4, 'C');
+    SendMsg(A, MSG_TYPE_INIT, 0, 0);
+
+    // In steps short enough that the timeline buffer never wraps between reads
+    for (t = 0; t < 3600; t++) {
+        SimRun(1000L);
+        n = SimTimeline(ev, SIM_TIMELINE_SIZE);
+        CHECK(SimDispatches() - seen <= n);
+        for (i = (WORD)(n - (SimDispatches() - seen)); i < n; i++) { Fold(&ev[i]); }
+        seen = SimDispatches();
+    }
+
+    CHECK(GetTicks() == 3600000L);
+    CHECK(na == 3599);                    // Timer dispatches at 1000 .. 3599000
+    CHECK(nb == 359);
+    CHECK(b_last_s == 3590);
+    CHECK(b_last_at == 3590000L);         // Delivered in the same virtual tick
+    CHECK(nc == 35);
+    // INIT, A's timers, B's and C's messages, and C's two Sleep() wake-ups
+    CHECK(SimDispatches() == 1 + 3599 + 359 + 3 * 35);
+
+    CHECK(digest == 0x068618acUL);       // Same value for both TCB layouts
+    n = SimTimeline(ev, SIM_TIMELINE_SIZE);
+    CHECK(n == SIM_TIMELINE_SIZE);
+    for (i = 1; i < n; i++) {
+        CHECK(ev[i].Start >= ev[i - 1].Start);
+    }
+    // C's last message at 3500000 ends with a 10-tick dispatch after two 250-tick sleeps
+    for (i = 0; i < n; i++) {
+        if (ev[i].TaskID == 'C' && ev[i].Ticks != 0) {
+            CHECK(ev[i].Start == 3500500L);
+            CHECK(ev[i].Ticks == 10);
+        }
+    }
+    return TEST_END();
+}
@@ -0,0 +1,59 @@
+// Byte streams: a write that wraps the buffer is read through StreamReadRegion,
+// which only returns the part up to the end. The remainder is below the trigger
+// and must still reach the reader after IdleTimeout ticks.
+#include "ktest.h"
+
+static struct STREAM *S;
+static struct TASK *Reader;
+static int got;
+static LONG last_at;
+static BYTE data[24];
+
+static WORD ReaderTask(WORD MsgType, WORD sParam, LONG lParam)
+{
+    BYTE *region;
+    WORD n, i;
+    (void)sParam;
+    (void)lParam;
+    if (MsgType == 30) {
+        n = StreamReadRegion(S, &region);
+        for (i = 0; i < n; i++) { CHECK(region[i] == data[got + i]); }
+        got += n;
+        last_at = GetTicks();
+        StreamCommitRead(S, n);
+    }
+    return MSG_WAIT;
+}
+
+static WORD Writer(WORD MsgType, WORD sParam, LONG lParam)
+{
+    static int step;
+    (void)MsgType;
+    (void)sParam;
+    (void)lParam;
+    if (step++ == 0) {
+        CHECK(StreamWrite(S, data, 12) == 12);      // Reaches the trigger: read at once
+        return 10;
+    }
+    CHECK(StreamWrite(S, data + 12, 10) == 10);     // Wraps: 4 bytes up to the end, 6 after
+    return MSG_WAIT;
+}
+
+int main(void)
+{
+    struct TASK *w;
+    int i;
+
+    for (i = 0; i < (int)sizeof(data); i++) { data[i] = (BYTE)(i * 7 + 1); }
+    Reader = InitTask(ReaderTask, 2048, 4, 'R');
+    w = InitTask(Writer, 2048, 4, 'W');
+    S = InitStream(16, Reader, 30, 8, 5);
+    SendMsg(w, MSG_TYPE_INIT, 0, 0);
+
+    SimRun(100L);
+
+    CHECK(got == 22);
+    CHECK(last_at == 15);   // The 6-byte remainder, IdleTimeout after the wrapped read
+    CHECK(StreamCount(S) == 0);
+    return TEST_END();
+}
@@ -0,0 +1,86 @@
+// Topics: Publish() reaches every subscriber with the same message, a subscriber
+// whose queue is full loses the message and has it counted by GetTopicDropped(),
+// and a deleted task leaves every topic, so its reused slot gets nothing.
+#include "ktest.h"
+
+#define SUBS 3
+
+static struct TASK *Subs[SUBS];
+static int Got[SUBS];
+static LONG Sum[SUBS];
+
+// Publish() gives every subscriber the same sParam, so each has its own function
+static WORD Count(int i, WORD MsgType, LONG lParam)
+{
+    if (MsgType == 20) {
+        ++Got[i];
+        Sum[i] += lParam;
+    }
+    return MSG_WAIT;
+}
+
+static WORD Sub0(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Count(0, MsgType, lParam); }
+static WORD Sub1(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Count(1, MsgType, lParam); }
+static WORD Sub2(WORD MsgType, WORD sParam, LONG lParam) { (void)sParam; return Count(2, MsgType, lParam); }
+
+static WORD (*const Funcs[SUBS])(WORD, WORD, LONG) = { Sub0, Sub1, Sub2 };
+
+// Deletes Subs[sParam] from task context
+static WORD Reaper(WORD MsgType, WORD sParam, LONG lParam)
+{
+    (void)lParam;
+    if (MsgType == 40) { DeleteTask(Subs[sParam]); }
+    return MSG_WAIT;
+}
+
+int main(void)
+{
+    struct TOPIC *t;
+    struct TASK *again, *r;
+    int i;
+
+    for (i = 0; i < SUBS; i++) { Subs[i] = InitTask(Funcs[i], 2048, i == 2 ? 2 : 4, 'a' + i); }
+    r = InitTask(Reaper, 2048, 2, 'R');
+    t = InitTopic(SUBS);
+    for (i = 0; i < SUBS; i++) { CHECK(Subscribe(t, Subs[i])); }
+    CHECK(Subscribe(t, Subs[0]));   // Already there: not a second entry
+
+    // Delivered to all
+    CHECK(Publish(t, 20, 0, 5) == SUBS);
+    SimRun(5);
+    for (i = 0; i < SUBS; i++) {
+        CHECK(Got[i] == 1);
+        CHECK(Sum[i] == 5);
+        CHECK(GetTopicDropped(t, Subs[i]) == 0);
+    }
+
+    // Nobody runs in between: the third and fourth publish overflow c's 2 slots
+    CHECK(Publish(t, 20, 0, 1) == SUBS);
+    CHECK(Publish(t, 20, 0, 2) == SUBS);
+    CHECK(Publish(t, 20, 0, 3) == SUBS - 1);
+    CHECK(Publish(t, 20, 0, 4) == SUBS - 1);
+    SimRun(5);
+    CHECK(Got[0] == 5 && Got[1] == 5);
+    CHECK(Got[2] == 3 && Sum[2] == 5 + 1 + 2);
+    CHECK(GetTopicDropped(t, Subs[0]) == 0);
+    CHECK(GetTopicDropped(t, Subs[2]) == 2);
+
+    // Deleted: gone from the topic, and its memory back under a new task
+    SendMsg(r, 40, 1, 0);
+    SimRun(5);
+    CHECK(GetTopicDropped(t, Subs[1]) == 0);
+    CHECK(Publish(t, 20, 0, 6) == SUBS - 1);
+    again = InitTask(Sub1, 2048, 4, 'b');
+    CHECK(again == Subs[1]);
+    CHECK(Publish(t, 20, 0, 7) == SUBS - 1);
+    SimRun(5);
+    CHECK(Got[0] == 7 && Got[1] == 5 && Got[2] == 5);
+
+    // Free room again after unsubscribing, and a resubscribed task gets the next one
+    Unsubscribe(t, Subs[0]);
+    CHECK(Subscribe(t, again));
+    CHECK(Publish(t, 20, 0, 8) == SUBS - 1);
+    SimRun(5);
+    CHECK(Got[0] == 7 && Got[1] == 6 && Sum[1] == 5 + 1 + 2 + 3 + 4 + 8);
+    return TEST_END();
+}